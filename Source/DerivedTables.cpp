@@ -0,0 +1,157 @@
+//
+//  DerivedTables.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#include "DerivedTables.hpp"
+
+bool TableInputs::potentialEquals(const TableInputs& other) const
+{
+    return potentialType == other.potentialType && potentialShift == other.potentialShift
+        && potentialScale == other.potentialScale && potentialAmount == other.potentialAmount
+        && potentialFormula[0].getHash() == other.potentialFormula[0].getHash()
+        && potentialFormula[1].getHash() == other.potentialFormula[1].getHash();
+}
+
+bool TableInputs::operator==(const TableInputs& other) const
+{
+    return potentialEquals(other) && timestepDelta == other.timestepDelta
+        && stereoAmount == other.stereoAmount
+        && waveTypeNumber == other.waveTypeNumber && waveShift == other.waveShift && waveScale == other.waveScale
+        && waveFormula.getHash() == other.waveFormula.getHash() && sampleType == other.sampleType;
+}
+
+
+TableBuilder::TableBuilder() : Thread("QSynthi table builder")
+{
+}
+
+TableBuilder::~TableBuilder()
+{
+    stopThread(1000);
+}
+
+void TableBuilder::start(const TableInputs& inputs)
+{
+    build(inputs);
+    startThread();
+}
+
+void TableBuilder::post(const TableInputs& inputs)
+{
+    auto& slot = requested.getWriteBuffer();
+    slot = inputs;
+    requested.publish();
+    notify();
+}
+
+void TableBuilder::run()
+{
+    while (!threadShouldExit())
+    {
+        const auto& inputs = requested.read();
+        if (requested.getReadVersion() != builtRequest)
+        {
+            builtRequest = requested.getReadVersion();
+            build(inputs);
+        }
+        // Until the next post() (or stopThread). A post during the build leaves the event signalled, so it is not missed
+        wait(-1);
+    }
+}
+
+void TableBuilder::build(const TableInputs& inputs)
+{
+    constexpr size_t n = Wavetable::SIZE;
+    const float dt = inputs.timestepDelta;
+
+    const bool potentialChanged = !built || !inputs.potentialEquals(builtInputs);
+    const bool dtChanged = !built || inputs.timestepDelta != builtInputs.timestepDelta;
+    const bool stereoChanged = !built || inputs.stereoAmount != builtInputs.stereoAmount;
+    const bool displayChanged = !built || inputs.waveTypeNumber != builtInputs.waveTypeNumber || inputs.waveShift != builtInputs.waveShift
+        || inputs.waveScale != builtInputs.waveScale || inputs.waveFormula.getHash() != builtInputs.waveFormula.getHash()
+        || inputs.sampleType != builtInputs.sampleType;
+
+    if (!potentialChanged && !dtChanged && !stereoChanged && !displayChanged)
+        return;
+
+    // Potential
+    if (potentialChanged)
+    {
+        // Cached: changing only the amounts does not generate again
+        const cfloat* p1 = potentialCache.generate(inputs.potentialType[0], inputs.potentialShift[0], inputs.potentialScale[0], &inputs.potentialFormula[0]);
+        const cfloat* p2 = potentialCache.generate(inputs.potentialType[1], inputs.potentialShift[1], inputs.potentialScale[1], &inputs.potentialFormula[1]);
+        for (size_t i = 0; i < n; i++)
+            tables.potential[i] = Parameter::POTENTIAL_SCALE * (inputs.potentialAmount[0] * std::real(p1[i]) + inputs.potentialAmount[1] * std::real(p2[i]));
+        tables.potentialVersion++;
+    }
+
+    // Solver phase factors ("timestepV" and "timestepT" in VoiceBank::doTimestep)
+    if (potentialChanged || dtChanged)
+    {
+        tables.timestepDelta = dt;
+        for (size_t i = 0; i < n; i++)
+            tables.potentialPhase[i] = std::polar(1.f, dt * tables.potential[i]);
+
+        const float PRE = powf(Wavetable::TWO_PI / n, 2) * dt;
+        for (size_t i = 0; i < n / 2; i++)
+        {
+            tables.kineticPhase[i]         = std::polar(1.f, PRE * i * i);
+            tables.kineticPhase[n - (i+1)] = std::polar(1.f, PRE * (i+1) * (i+1));
+        }
+        tables.phaseVersion++;
+    }
+
+    // Stereo
+    if (stereoChanged)
+    {
+        const float stereoAmount = inputs.stereoAmount;
+        for (size_t i = 0; i < n; i++)
+            tables.stereoLeft[i] = 1 - stereoAmount * 0.5f * (std::tanhf(Wavetable::TWO_PI * (i / Wavetable::SIZE_F - 0.5f)) + 1);
+
+        // The right channel mirrors the left one
+        for (size_t i = 0; i < n; i++)
+            tables.stereoRight[i] = tables.stereoLeft[n - 1 - i];
+        tables.stereoVersion++;
+    }
+
+    if (potentialChanged || dtChanged || stereoChanged)
+    {
+        published.getWriteBuffer() = tables;
+        published.publish();
+    }
+
+    if (potentialChanged || displayChanged)
+        publishSnapshot(inputs);
+
+    builtInputs = inputs;
+    built = true;
+}
+
+// Editor snapshots -------------------------------------------------------------------------------------------------------------------
+//
+
+ParameterSnapshot::Ptr TableBuilder::getSnapshot() const
+{
+    const SpinLock::ScopedLockType lock(snapshotLock);
+    return snapshot;
+}
+
+void TableBuilder::publishSnapshot(const TableInputs& inputs)
+{
+    ParameterSnapshot::Ptr next = new ParameterSnapshot();
+    next->potential = list<float>(std::vector<float>(tables.potential.begin(), tables.potential.end()));
+    next->waveTypeNumber = inputs.waveTypeNumber;
+    next->waveShift = inputs.waveShift;
+    next->waveScale = inputs.waveScale;
+    next->waveFormula = inputs.waveFormula;
+    next->sampleType = inputs.sampleType;
+
+    // The old snapshot is released after the lock, it is deleted here unless an editor still holds it
+    {
+        const SpinLock::ScopedLockType lock(snapshotLock);
+        std::swap(snapshot, next);
+    }
+}
@@ -0,0 +1,123 @@
+//
+//  DerivedTables.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include <array>
+#include <vector>
+#include "Wavetable.hpp"
+#include "TripleBuffer.h"
+
+/**
+ Parameter values the derived tables are built from. Filled by Parameter::update, compared per table to find out what to rebuild.
+ */
+struct TableInputs
+{
+    // Potential
+    std::array<float, 2> potentialType{}, potentialShift{}, potentialScale{}, potentialAmount{};
+    std::array<Formula, 2> potentialFormula{};      // compared by hash
+    // Solver
+    float timestepDelta = 0;
+    // Stereo
+    float stereoAmount = 0;
+    // Only shown by the editor
+    int waveTypeNumber = 0;
+    float waveShift = 0, waveScale = 0;
+    Formula waveFormula;
+    SampleType sampleType = SQARED_ABS;
+
+    bool potentialEquals(const TableInputs& other) const;
+    bool operator==(const TableInputs& other) const;
+    bool operator!=(const TableInputs& other) const { return !(*this == other); }
+};
+
+/**
+ Tables derived from the parameters. Each table carries a version that changes whenever it was rebuilt.
+ */
+struct DerivedTables
+{
+    uint32 potentialVersion = 0;
+    uint32 phaseVersion = 0;
+    uint32 stereoVersion = 0;
+
+    std::array<float, Wavetable::SIZE> potential{};
+    // Solver phase factors of one timestep: exp(i dt V) per point and exp(i dt k^2 ...) per wave number (in FFT order)
+    float timestepDelta = 0;                                    // dt of the phase factors
+    std::array<cfloat, Wavetable::SIZE> potentialPhase{};
+    std::array<cfloat, Wavetable::SIZE> kineticPhase{};
+    // Stereo weights, indexed by table position
+    std::array<float, Wavetable::SIZE> stereoLeft{};
+    std::array<float, Wavetable::SIZE> stereoRight{};
+};
+
+/**
+ Immutable view of the parameters for the editor, never modified after it was published.
+ */
+struct ParameterSnapshot : public ReferenceCountedObject
+{
+    using Ptr = ReferenceCountedObjectPtr<ParameterSnapshot>;
+
+    list<float> potential;
+    int waveTypeNumber = 0;
+    float waveShift = 0;
+    float waveScale = 0;
+    Formula waveFormula;
+    SampleType sampleType = SQARED_ABS;
+
+    std::function<float(cfloat)> getSampleConverter() const { return Parameter::getSampleConverter(sampleType); }
+};
+
+/**
+ Rebuilds the derived tables on a background thread and hands them to the audio thread.
+
+ The audio thread posts the current inputs once per block if they changed and wakes the builder, which sleeps otherwise.
+ The builder rebuilds only the tables whose inputs differ and publishes the result through a TripleBuffer, so the audio
+ thread swaps to new tables with a single atomic exchange.
+ Dragging a knob therefore never runs generate(), tanh or sincos on the audio thread.
+
+ The builder also publishes a ParameterSnapshot for the editor whenever a displayed value changed. The pointer is swapped
+ and copied under snapshotLock, so a reader always holds its reference before the builder can drop the old snapshot.
+ The audio thread never touches snapshots.
+ */
+class TableBuilder : private Thread
+{
+public:
+    TableBuilder();
+    ~TableBuilder() override;
+
+    // Builds the first tables on the calling thread and starts the background thread
+    void start(const TableInputs& inputs);
+
+    // Audio thread ------------------------------------------------------------------------------------------
+    // Only called when the inputs changed: notify() takes the wake-up event's lock for a moment
+    void post(const TableInputs& inputs);
+    // The latest published tables, valid until the next call
+    inline const DerivedTables& getTables() { return published.read(); }
+
+    // Any thread except the audio thread (takes a reference)
+    ParameterSnapshot::Ptr getSnapshot() const;
+
+private:
+    TripleBuffer<TableInputs> requested;
+    TripleBuffer<DerivedTables> published;
+
+    // Builder thread only
+    DerivedTables tables;
+    TableInputs builtInputs;
+    WavetableCache potentialCache;
+    bool built = false;
+    uint64 builtRequest = 0;
+
+    // Written by the builder, copied by getSnapshot(), both under snapshotLock
+    ParameterSnapshot::Ptr snapshot;
+    mutable SpinLock snapshotLock;
+
+    void run() override;
+    void build(const TableInputs& inputs);
+    void publishSnapshot(const TableInputs& inputs);
+};
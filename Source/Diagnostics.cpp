@@ -0,0 +1,337 @@
+/*
+  ==============================================================================
+
+    Diagnostics.cpp
+    Created: 19 Oct 2026 2:31:07pm
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#include "Diagnostics.h"
+
+#if QSYNTHI_DIAGNOSTICS
+
+#include "QSynthi.hpp"
+#include <new>
+#include <cstdlib>
+
+static thread_local bool allocationGuardActive = false;
+static thread_local int allocationCount = 0;
+
+static void* countedAlloc(std::size_t size)
+{
+    if (allocationGuardActive)
+        allocationCount++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+// Aligned memory needs its own free on Windows, and aligned_alloc wants a multiple of the alignment
+static void* countedAlignedAlloc(std::size_t size, std::align_val_t alignment)
+{
+    if (allocationGuardActive)
+        allocationCount++;
+    const auto align = static_cast<std::size_t>(alignment);
+    const std::size_t bytes = size == 0 ? 1 : size;
+   #if JUCE_WINDOWS
+    return _aligned_malloc(bytes, align);
+   #else
+    return std::aligned_alloc(align, (bytes + align - 1) / align * align);
+   #endif
+}
+
+static void alignedFree(void* memory)
+{
+   #if JUCE_WINDOWS
+    _aligned_free(memory);
+   #else
+    std::free(memory);
+   #endif
+}
+
+void* operator new(std::size_t size)
+{
+    if (void* memory = countedAlloc(size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return countedAlloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    if (void* memory = countedAlignedAlloc(size, alignment))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return countedAlignedAlloc(size, alignment);
+}
+
+void operator delete(void* memory) noexcept                                          { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept                             { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept                   { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept                        { alignedFree(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept           { alignedFree(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { alignedFree(memory); }
+
+
+Diagnostics::ScopedAllocationGuard::ScopedAllocationGuard()
+    : wasActive{ allocationGuardActive }, startCount{ allocationCount }
+{
+    allocationGuardActive = true;
+}
+
+Diagnostics::ScopedAllocationGuard::~ScopedAllocationGuard()
+{
+    allocationGuardActive = wasActive;
+}
+
+int Diagnostics::ScopedAllocationGuard::getAllocationCount() const
+{
+    return allocationCount - startCount;
+}
+
+
+int Diagnostics::runNoteStormCheck(Parameter& parameter, const float sampleRate)
+{
+    constexpr int blockSize = 512;
+    constexpr int numBlocks = 64;
+
+    // Everything the host would own is set up before the guard. The voice count is applied by the first guarded block
+    QSynthi synth(&parameter);
+    synth.prepareToPlay(sampleRate);
+    synth.postVoiceCount(VoiceBank::MAX_VOICES);
+    AudioBuffer<float> buffer(2, blockSize);
+
+    std::vector<MidiBuffer> blocks(numBlocks);
+    for (int block = 0; block < numBlocks; block++)
+    {
+        auto& midi = blocks[block];
+        midi.ensureSize(4096);
+
+        // runStolenNoteCheck at full polyphony: 0 is stolen by the last of the other notes and pressed again,
+        // its second voice has to be released when the voice of 1 takes it back on a note-off
+        if (block % 16 == 8)
+        {
+            midi.addEvent(MidiMessage::controllerEvent(1, 64, 0), 0);
+            midi.addEvent(MidiMessage::allNotesOff(1), 0);
+            for (int note = 0; note <= VoiceBank::MAX_VOICES; note++)
+                midi.addEvent(MidiMessage::noteOn(1, note, (uint8) 100), 1 + note);
+            midi.addEvent(MidiMessage::noteOn(1, 0, (uint8) 100), VoiceBank::MAX_VOICES + 2);
+            midi.addEvent(MidiMessage::noteOff(1, VoiceBank::MAX_VOICES), VoiceBank::MAX_VOICES + 3);
+            midi.addEvent(MidiMessage::noteOff(1, 1), VoiceBank::MAX_VOICES + 4);
+            midi.addEvent(MidiMessage::noteOff(1, 0), VoiceBank::MAX_VOICES + 5);
+            continue;
+        }
+
+        if (block % 8 == 0) midi.addEvent(MidiMessage::controllerEvent(1, 64, 127), 0);
+        for (int note = 0; note < 128; note++)
+        {
+            const int position = (note * 7 + block * 13) % blockSize;
+            if ((note + block) % 3 != 2) midi.addEvent(MidiMessage::noteOn(1, note, (uint8) (1 + (note * 5 + block) % 127)), position);
+            else                         midi.addEvent(MidiMessage::noteOff(1, note), position);
+        }
+        if (block % 8 == 4) midi.addEvent(MidiMessage::controllerEvent(1, 64, 0), blockSize - 1);
+        if (block % 16 == 15) midi.addEvent(MidiMessage::allNotesOff(1), blockSize - 1);
+    }
+
+    int allocations = 0;
+    for (auto& midi : blocks)
+    {
+        buffer.clear();
+        const ScopedAllocationGuard guard;
+        synth.processBlock(buffer, midi);
+        allocations += guard.getAllocationCount();
+    }
+
+    // Pedal up and all notes off: every voice has to fall asleep, none may be left without its note
+    MidiBuffer release, none;
+    release.addEvent(MidiMessage::controllerEvent(1, 64, 0), 0);
+    release.addEvent(MidiMessage::allNotesOff(1), 0);
+    const int maxReleaseBlocks = static_cast<int>(20 * sampleRate / blockSize);
+    for (int block = 0; block < maxReleaseBlocks && synth.getNumActiveVoices() > 0; block++)
+    {
+        buffer.clear();
+        synth.processBlock(buffer, block == 0 ? release : none);
+    }
+    const int remaining = synth.getNumActiveVoices();
+
+    DBG("Note storm check: " << allocations << " allocations on the audio path, " << remaining << " voices still active");
+    jassert(allocations == 0 && remaining == 0);
+    return allocations + remaining;
+}
+
+int Diagnostics::runStolenNoteCheck(Parameter& parameter, const float sampleRate)
+{
+    constexpr int blockSize = 512;
+    const int maxBlocks = static_cast<int>(20 * sampleRate / blockSize);     // longer than the longest release
+
+    QSynthi synth(&parameter);
+    synth.prepareToPlay(sampleRate);
+    synth.postVoiceCount(2);
+    AudioBuffer<float> buffer(2, blockSize);
+
+    // 60 is stolen by 64, pressed again on the voice of 62 and released after both others
+    MidiBuffer midi, none;
+    int position = 0;
+    for (int note : { 60, 62, 64, 60 })
+        midi.addEvent(MidiMessage::noteOn(1, note, (uint8) 100), position++);
+    for (int note : { 64, 62, 60 })
+        midi.addEvent(MidiMessage::noteOff(1, note), position++);
+
+    buffer.clear();
+    synth.processBlock(buffer, midi);
+    for (int block = 0; block < maxBlocks && synth.getNumActiveVoices() > 0; block++)
+    {
+        buffer.clear();
+        synth.processBlock(buffer, none);
+    }
+
+    const int remaining = synth.getNumActiveVoices();
+    DBG("Stolen note check: " << remaining << " voices still active");
+    jassert(remaining == 0);
+    return remaining;
+}
+
+void Diagnostics::runWavetableBenchmark()
+{
+    constexpr int iterations = 4096;
+    cfloat out[Wavetable::SIZE];
+    float checksum = 0;     // keeps the results alive
+
+    // The custom type is measured with the Gaussian written as a formula
+    Formula custom;
+    Formula::compile("exp(-(11.06 * (x - 0.5 - shift / 2))^2)", custom);
+
+    const auto secondsPerCall = [](int64 startTicks)
+    {
+        return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) / iterations;
+    };
+
+    for (int type = 0; type < Parameter::WAVE_TYPES.size(); type++)
+    {
+        // A different shift every call, so nothing can be reused
+        int64 start = Time::getHighResolutionTicks();
+        for (int n = 0; n < iterations; n++)
+        {
+            Wavetable::generate(type, -1.f + 2.f * n / iterations, 0.3f, out, &custom);
+            checksum += std::real(out[n % Wavetable::SIZE]);
+        }
+        const double generated = secondsPerCall(start);
+
+        WavetableCache cache;
+        start = Time::getHighResolutionTicks();
+        for (int n = 0; n < iterations; n++)
+            checksum += std::real(cache.generate(type, 0.2f, 0.3f, &custom)[n % Wavetable::SIZE]);
+        const double cached = secondsPerCall(start);
+
+        DBG("Wavetable benchmark " << Parameter::WAVE_TYPES[type] << ": "
+            << generated * 1.0e9 << " ns generated, " << cached * 1.0e9 << " ns cached");
+    }
+    DBG("(checksum " << checksum << ")");
+}
+
+void Diagnostics::runPhaseFactorBenchmark()
+{
+    constexpr int iterations = 4096;
+    constexpr size_t n = Wavetable::SIZE;
+    alignas(32) float angle[n];
+    cfloat reference[n];
+    cfloat fast[n];
+    float checksum = 0;
+
+    // A parabola potential at full amount, dt = 0.1, scaled a little differently every call
+    const list<cfloat> potential = Wavetable::generate(WaveType::PARABOLA, 0.f, 0.f);
+    const auto fill = [&](int call) {
+        for (size_t i = 0; i < n; i++)
+            angle[i] = 0.1f * 100.f * std::real(potential[i]) * (1.f + call * 1.0e-4f);
+    };
+
+    int64 start = Time::getHighResolutionTicks();
+    for (int call = 0; call < iterations; call++)
+    {
+        fill(call);
+        for (size_t i = 0; i < n; i++)
+            reference[i] = std::polar(1.f, angle[i]);
+        checksum += std::real(reference[call % n]);
+    }
+    const double polarTime = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) / iterations;
+
+    start = Time::getHighResolutionTicks();
+    for (int call = 0; call < iterations; call++)
+    {
+        fill(call);
+        FastMath::polar<n>(angle, fast);
+        checksum += std::real(fast[call % n]);
+    }
+    const double fastTime = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) / iterations;
+
+    float maxError = 0;
+    for (size_t i = 0; i < n; i++)
+        maxError = std::max(maxError, std::abs(reference[i] - fast[i]));
+
+    DBG("Phase factor benchmark: " << polarTime * 1.0e9 << " ns std::polar, " << fastTime * 1.0e9 << " ns FastMath::polar, "
+        << "max difference " << maxError << " (checksum " << checksum << ")");
+}
+
+void Diagnostics::runReleaseBenchmark(Parameter& parameter, const float sampleRate)
+{
+    constexpr int blockSize = 512;
+    constexpr int heldBlocks = 64;
+    const int maxReleaseBlocks = static_cast<int>(30 * sampleRate / blockSize);    // longest release plus the reverb tail
+
+    const auto run = [&](const char* mode)
+    {
+        QSynthi synth(&parameter);
+        synth.prepareToPlay(sampleRate);
+        synth.postVoiceCount(VoiceBank::MAX_VOICES);
+        AudioBuffer<float> buffer(2, blockSize);
+
+        MidiBuffer notesOn, notesOff, none;
+        for (int voice = 0; voice < VoiceBank::MAX_VOICES; voice++)
+            notesOn.addEvent(MidiMessage::noteOn(1, 36 + voice, (uint8) 100), 0);
+        notesOff.addEvent(MidiMessage::allNotesOff(1), 0);
+
+        const auto timeBlock = [&](const MidiBuffer& midi)
+        {
+            buffer.clear();
+            const int64 start = Time::getHighResolutionTicks();
+            synth.processBlock(buffer, midi);
+            return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start);
+        };
+
+        timeBlock(notesOn);
+        double held = 0;
+        for (int block = 0; block < heldBlocks; block++)
+            held += timeBlock(none);
+
+        double release = timeBlock(notesOff);
+        double slowest = release;
+        int releaseBlocks = 1;
+        while (buffer.getMagnitude(0, blockSize) > 0 && releaseBlocks < maxReleaseBlocks)
+        {
+            const double seconds = timeBlock(none);
+            release += seconds;
+            slowest = std::max(slowest, seconds);
+            releaseBlocks++;
+        }
+
+        DBG("Release benchmark (" << mode << "): " << held / heldBlocks * 1.0e6 << " us per block held, "
+            << release / releaseBlocks * 1.0e6 << " us mean and " << slowest * 1.0e6 << " us slowest of "
+            << releaseBlocks << " blocks releasing");
+    };
+
+    run("subnormals");
+    {
+        const ScopedNoDenormals noDenormals;
+        run("flush-to-zero");
+    }
+}
+
+#endif  // QSYNTHI_DIAGNOSTICS
@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    Diagnostics.h
+    Created: 19 Oct 2026 2:31:07pm
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// Development checks, not part of the plugin. QSynthiDiagnostics.jucer builds them as a console app (DiagnosticsMain.cpp)
+// with QSYNTHI_DIAGNOSTICS=1 in its preprocessor definitions.
+#ifndef QSYNTHI_DIAGNOSTICS
+ #define QSYNTHI_DIAGNOSTICS 0
+#endif
+
+#if QSYNTHI_DIAGNOSTICS
+
+class Parameter;
+
+class Diagnostics
+{
+public:
+    /**
+     Counts heap allocations (global operator new, including the aligned and nothrow forms) of the current thread while
+     it exists.
+     */
+    class ScopedAllocationGuard
+    {
+    public:
+        ScopedAllocationGuard();
+        ~ScopedAllocationGuard();
+        int getAllocationCount() const;
+
+    private:
+        bool wasActive;
+        int startCount;
+    };
+
+    /**
+     Plays a note storm through a fresh synth at MAX_VOICES: all 128 notes with retriggers, sustain pedal, voice
+     stealing and stolen notes pressed again, then releases everything. Returns the number of allocations inside
+     processBlock plus the voices still active after the release (should be 0).
+     The parameter must be updated beforehand, since its first update attaches it to the tree state.
+     */
+    static int runNoteStormCheck(Parameter& parameter, float sampleRate);
+
+    /**
+     Presses a note again after its voice was stolen (2 voices: on 60, 62, 64, 60, off 64, 62, 60) and renders until
+     all voices are asleep. Returns the number of voices still active after the longest release (should be 0).
+     */
+    static int runStolenNoteCheck(Parameter& parameter, float sampleRate);
+
+    /**
+     Times Wavetable::generate for every WaveType, once generating and once as WavetableCache hit, and prints the
+     time per call.
+     */
+    static void runWavetableBenchmark();
+
+    /**
+     Times one table of potential phase factors, with std::polar and with FastMath::polar (per-voice modulation),
+     and prints the time per table and the largest difference.
+     */
+    static void runPhaseFactorBenchmark();
+
+    /**
+     Plays all voices, releases them and times every block until the reverb tail is gone, once with subnormal numbers
+     and once with flush-to-zero like the processor. Prints the mean block time while held and the mean and slowest
+     block while releasing, which should stay close to each other.
+     */
+    static void runReleaseBenchmark(Parameter& parameter, float sampleRate);
+};
+
+#endif  // QSYNTHI_DIAGNOSTICS
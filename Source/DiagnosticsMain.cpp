@@ -0,0 +1,68 @@
+/*
+  ==============================================================================
+
+    DiagnosticsMain.cpp
+    Created: 19 Oct 2026 4:12:45pm
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "Diagnostics.h"
+#include "Parameter.h"
+#include "DerivedTables.hpp"     // completes the types Parameter owns
+
+#if QSYNTHI_DIAGNOSTICS
+
+/**
+ Owns the tree state that the Parameter reads, like QSynthiAudioProcessor does in the plugin. Renders nothing itself.
+ */
+class DiagnosticsProcessor : public AudioProcessor
+{
+public:
+    AudioProcessorValueTreeState treeState { *this, nullptr, "Parameters", Parameter::createParameterLayout() };
+
+    const String getName() const override { return "QSynthi Diagnostics"; }
+    void prepareToPlay(double, int) override {}
+    void releaseResources() override {}
+    void processBlock(AudioBuffer<float>&, MidiBuffer&) override {}
+    double getTailLengthSeconds() const override { return 0; }
+    bool acceptsMidi() const override { return true; }
+    bool producesMidi() const override { return false; }
+    AudioProcessorEditor* createEditor() override { return nullptr; }
+    bool hasEditor() const override { return false; }
+    int getNumPrograms() override { return 1; }
+    int getCurrentProgram() override { return 0; }
+    void setCurrentProgram(int) override {}
+    const String getProgramName(int) override { return {}; }
+    void changeProgramName(int, const String&) override {}
+    void getStateInformation(MemoryBlock&) override {}
+    void setStateInformation(const void*, int) override {}
+};
+
+/**
+ Runs the checks and benchmarks of Diagnostics once with the default parameters, outside of any host.
+ Returns the number of failed checks.
+ */
+int main(int, char**)
+{
+    const ScopedJuceInitialiser_GUI juceInitialiser;
+    constexpr float sampleRate = 44100.f;
+
+    DiagnosticsProcessor processor;
+    Parameter parameter;
+    parameter.update(processor.treeState, sampleRate);
+
+    int failures = 0;
+    if (Diagnostics::runNoteStormCheck(parameter, sampleRate) != 0)  failures++;
+    if (Diagnostics::runStolenNoteCheck(parameter, sampleRate) != 0) failures++;
+
+    Diagnostics::runWavetableBenchmark();
+    Diagnostics::runPhaseFactorBenchmark();
+    Diagnostics::runReleaseBenchmark(parameter, sampleRate);
+
+    return failures;
+}
+
+#endif  // QSYNTHI_DIAGNOSTICS
@@ -0,0 +1,78 @@
+//
+//  FFT.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#include "FFT.hpp"
+#include "JuceHeader.h"
+#include <cmath>
+
+FFT::FFT(const size_t size)
+    : size{ size }, twiddleReal(size / 2), twiddleImag(size / 2), bitReversed(size)
+{
+    jassert(size > 0 && (size & (size - 1)) == 0);
+
+    for (size_t k = 0; k < size / 2; k++)
+    {
+        const double angle = MathConstants<double>::twoPi * k / size;
+        twiddleReal[k] = static_cast<float>(std::cos(angle));
+        twiddleImag[k] = static_cast<float>(-std::sin(angle));
+    }
+
+    size_t bits = 0;
+    while ((size_t(1) << bits) < size) bits++;
+    for (size_t i = 0; i < size; i++)
+    {
+        size_t reversed = 0;
+        for (size_t b = 0; b < bits; b++)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        bitReversed[i] = reversed;
+    }
+}
+
+void FFT::perform(cfloat* data, const bool forward, const float scale) const
+{
+    // Complex values as interleaved floats, avoids the NaN handling of std::complex multiplication
+    float* d = reinterpret_cast<float*>(data);
+    const float sign = forward ? 1.f : -1.f;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        const size_t j = bitReversed[i];
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    for (size_t length = 2; length <= size; length <<= 1)
+    {
+        const size_t half = length / 2;
+        const size_t step = size / length;
+
+        for (size_t start = 0; start < size; start += length)
+        {
+            for (size_t k = 0; k < half; k++)
+            {
+                const float wr = twiddleReal[k * step];
+                const float wi = sign * twiddleImag[k * step];
+
+                float* a = d + 2 * (start + k);
+                float* b = d + 2 * (start + k + half);
+                const float br = b[0] * wr - b[1] * wi;
+                const float bi = b[0] * wi + b[1] * wr;
+
+                b[0] = a[0] - br;
+                b[1] = a[1] - bi;
+                a[0] += br;
+                a[1] += bi;
+            }
+        }
+    }
+
+    if (scale != 1.f)
+    {
+        for (size_t i = 0; i < 2 * size; i++)
+            d[i] *= scale;
+    }
+}
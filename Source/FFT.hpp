@@ -0,0 +1,34 @@
+//
+//  FFT.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include <vector>
+#include <complex>
+
+typedef std::complex<float> cfloat;
+
+/**
+ In-place radix-2 FFT for one fixed power-of-two size.
+ All tables are built in the constructor, perform() does not allocate and can run on the audio thread.
+ */
+class FFT
+{
+public:
+    explicit FFT(size_t size);
+
+    // forward: exp(-i...), backward: exp(+i...); both directions multiply the result by scale
+    void perform(cfloat* data, bool forward, float scale) const;
+
+    inline size_t getSize() const { return size; }
+
+private:
+    size_t size;
+    std::vector<float> twiddleReal;      // cos(2 pi k / size), k < size / 2
+    std::vector<float> twiddleImag;      // -sin(2 pi k / size)
+    std::vector<size_t> bitReversed;
+};
@@ -0,0 +1,63 @@
+/*
+  ==============================================================================
+
+    FastMath.h
+    Created: 19 Oct 2026 6:12:40pm
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <complex>
+
+typedef std::complex<float> cfloat;
+
+/**
+ Vectorizable replacements for the standard functions, for whole tables on the audio thread.
+ */
+class FastMath
+{
+public:
+    /**
+     out[i] = exp(i * angle[i]) for N angles, like std::polar(1.f, angle[i]).
+
+     The angle is reduced to [-pi/4, pi/4] around the nearest multiple of pi/2 (pi/2 split in three parts, so large
+     angles keep their precision), then sine and cosine are minimax polynomials (Cephes). The quadrant selects and negates
+     them without branches, so every loop vectorizes. Absolute error about 1e-7 for |angle| < 1e4.
+     */
+    template <size_t N>
+    static void polar(const float* angle, cfloat* out)
+    {
+        constexpr float TWO_OVER_PI = 0.636619772367581f;
+        constexpr float PI_2_A = 1.5703125f;
+        constexpr float PI_2_B = 4.837512969970703125e-4f;
+        constexpr float PI_2_C = 7.54978995489188216e-8f;
+
+        alignas(32) float sine[N];
+        alignas(32) float cosine[N];
+
+        for (size_t i = 0; i < N; i++)
+        {
+            const float a = angle[i];
+            const int quadrant = static_cast<int>(a * TWO_OVER_PI + std::copysign(0.5f, a));
+            const float q = static_cast<float>(quadrant);
+            const float x = ((a - q * PI_2_A) - q * PI_2_B) - q * PI_2_C;
+            const float x2 = x * x;
+
+            const float s = x + x * x2 * (-1.6666654611e-1f + x2 * (8.3321608736e-3f + x2 * -1.9515295891e-4f));
+            const float c = 1.f - 0.5f * x2 + x2 * x2 * (4.166664568298827e-2f + x2 * (-1.388731625493765e-3f + x2 * 2.443315711809948e-5f));
+
+            // quadrant 0: (s, c), 1: (c, -s), 2: (-s, -c), 3: (-c, s). Selected by multiplying with 0 and 1 (exact)
+            const float swap = static_cast<float>(quadrant & 1);
+            const float sineSign = 1.f - static_cast<float>(quadrant & 2);
+            const float cosineSign = 1.f - static_cast<float>((quadrant + 1) & 2);
+            sine[i] = sineSign * (s * (1.f - swap) + c * swap);
+            cosine[i] = cosineSign * (c * (1.f - swap) + s * swap);
+        }
+
+        for (size_t i = 0; i < N; i++)
+            out[i] = cfloat(cosine[i], sine[i]);
+    }
+};
@@ -0,0 +1,407 @@
+//
+//  Formula.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#include "Formula.hpp"
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+// Operations -------------------------------------------------------------------------------------------------------------------------
+//
+
+template <Formula::Op op>
+inline float Formula::apply(const float a, const float b)
+{
+    if constexpr (op == ADD) return a + b;
+    if constexpr (op == SUB) return a - b;
+    if constexpr (op == MUL) return a * b;
+    if constexpr (op == DIV) return a / b;
+    if constexpr (op == POW) return std::pow(a, b);
+    if constexpr (op == MIN) return std::min(a, b);
+    if constexpr (op == MAX) return std::max(a, b);
+    if constexpr (op == NEG) return -a;
+    if constexpr (op == SQUARE) return a * a;
+    if constexpr (op == SIN) return std::sin(a);
+    if constexpr (op == COS) return std::cos(a);
+    if constexpr (op == TAN) return std::tan(a);
+    if constexpr (op == EXP) return std::exp(a);
+    if constexpr (op == LOG) return std::log(a);
+    if constexpr (op == SQRT) return std::sqrt(a);
+    if constexpr (op == ABS) return std::abs(a);
+    if constexpr (op == FLOOR) return std::floor(a);
+    return 0;
+}
+
+// a = op(a, b) for the whole table, unary operations ignore b
+template <Formula::Op op>
+inline void Formula::applyToTable(float* a, const float* b)
+{
+    for (size_t i = 0; i < SIZE; i++)
+        a[i] = apply<op>(a[i], b[i]);
+}
+
+float Formula::applyScalar(const Op op, const float a, const float b)
+{
+    switch (op)
+    {
+        case ADD:   return apply<ADD>(a, b);
+        case SUB:   return apply<SUB>(a, b);
+        case MUL:   return apply<MUL>(a, b);
+        case DIV:   return apply<DIV>(a, b);
+        case POW:   return apply<POW>(a, b);
+        case MIN:   return apply<MIN>(a, b);
+        case MAX:   return apply<MAX>(a, b);
+        case NEG:   return apply<NEG>(a, b);
+        case SQUARE: return apply<SQUARE>(a, b);
+        case SIN:   return apply<SIN>(a, b);
+        case COS:   return apply<COS>(a, b);
+        case TAN:   return apply<TAN>(a, b);
+        case EXP:   return apply<EXP>(a, b);
+        case LOG:   return apply<LOG>(a, b);
+        case SQRT:  return apply<SQRT>(a, b);
+        case ABS:   return apply<ABS>(a, b);
+        case FLOOR: return apply<FLOOR>(a, b);
+        default:    return 0;
+    }
+}
+
+int Formula::arity(const Op op)
+{
+    if (op <= PUSH_SCALE) return 0;
+    if (op <= MAX) return 2;
+    return 1;
+}
+
+
+// Interpreter ------------------------------------------------------------------------------------------------------------------------
+//
+
+void Formula::evaluate(const float shift, const float scale, float* out) const
+{
+    alignas(32) float stack[MAX_STACK][SIZE];
+    int top = -1;
+
+    for (int pc = 0; pc < numInstructions; pc++)
+    {
+        const Instruction& instruction = code[pc];
+        switch (instruction.op)
+        {
+            case PUSH_CONST: top++; std::fill(stack[top], stack[top] + SIZE, instruction.value); break;
+            case PUSH_SHIFT: top++; std::fill(stack[top], stack[top] + SIZE, shift); break;
+            case PUSH_SCALE: top++; std::fill(stack[top], stack[top] + SIZE, scale); break;
+            case PUSH_X:
+                top++;
+                for (size_t i = 0; i < SIZE; i++)
+                    stack[top][i] = i / static_cast<float>(SIZE);
+                break;
+
+            case ADD:   applyToTable<ADD>(stack[top - 1], stack[top]); top--; break;
+            case SUB:   applyToTable<SUB>(stack[top - 1], stack[top]); top--; break;
+            case MUL:   applyToTable<MUL>(stack[top - 1], stack[top]); top--; break;
+            case DIV:   applyToTable<DIV>(stack[top - 1], stack[top]); top--; break;
+            case POW:   applyToTable<POW>(stack[top - 1], stack[top]); top--; break;
+            case MIN:   applyToTable<MIN>(stack[top - 1], stack[top]); top--; break;
+            case MAX:   applyToTable<MAX>(stack[top - 1], stack[top]); top--; break;
+
+            case NEG:   applyToTable<NEG>(stack[top], stack[top]); break;
+            case SQUARE: applyToTable<SQUARE>(stack[top], stack[top]); break;
+            case SIN:   applyToTable<SIN>(stack[top], stack[top]); break;
+            case COS:   applyToTable<COS>(stack[top], stack[top]); break;
+            case TAN:   applyToTable<TAN>(stack[top], stack[top]); break;
+            case EXP:   applyToTable<EXP>(stack[top], stack[top]); break;
+            case LOG:   applyToTable<LOG>(stack[top], stack[top]); break;
+            case SQRT:  applyToTable<SQRT>(stack[top], stack[top]); break;
+            case ABS:   applyToTable<ABS>(stack[top], stack[top]); break;
+            case FLOOR: applyToTable<FLOOR>(stack[top], stack[top]); break;
+        }
+    }
+
+    if (top < 0)
+    {
+        std::fill(out, out + SIZE, 0.f);
+        return;
+    }
+    jassert(top == 0);
+
+    // Division by zero, log of negative values etc. must not reach the simulation
+    for (size_t i = 0; i < SIZE; i++)
+        out[i] = std::isfinite(stack[0][i]) ? stack[0][i] : 0.f;
+}
+
+
+// Parser -----------------------------------------------------------------------------------------------------------------------------
+//
+
+/**
+ Recursive descent parser that emits the bytecode directly:
+    sum     = product { ("+" | "-") product }
+    product = unary { ("*" | "/") unary }
+    unary   = ("-" | "+") unary | power
+    power   = primary [ "^" unary ]
+    primary = number | variable | constant | function "(" sum { "," sum } ")" | "(" sum ")"
+ */
+struct Formula::Compiler
+{
+    static constexpr std::pair<const char*, Op> FUNCTIONS[] = {
+        { "sin", SIN }, { "cos", COS }, { "tan", TAN }, { "exp", EXP }, { "log", LOG }, { "sqrt", SQRT },
+        { "abs", ABS }, { "floor", FLOOR }, { "min", MIN }, { "max", MAX }, { "pow", POW }
+    };
+
+    // Parentheses, signs and exponents the parser descends into. Bounds its own recursion, independent of the bytecode
+    static constexpr int MAX_NESTING = 64;
+
+    const std::string text;
+    size_t pos = 0;
+    Formula formula;
+    int depth = 0;          // of the bytecode stack
+    int nesting = 0;
+    bool ok = true;
+    String error;
+
+    explicit Compiler(const std::string& text) : text(text) {}
+
+    void fail(const String& message)
+    {
+        if (!ok) return;
+        ok = false;
+        error = message + " (at character " + String(static_cast<int>(pos + 1)) + ")";
+    }
+
+    void skipSpaces()
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+            pos++;
+    }
+
+    bool accept(const char c)
+    {
+        skipSpaces();
+        if (pos < text.size() && text[pos] == c)
+        {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool isDigit(const size_t at) const
+    {
+        return at < text.size() && std::isdigit(static_cast<unsigned char>(text[at]));
+    }
+
+    void emit(const Op op, const float value = 0)
+    {
+        if (!ok) return;
+        const int n = arity(op);
+        auto& code = formula.code;
+        auto& count = formula.numInstructions;
+
+        // Constant folding: an operation on constants becomes a constant
+        if (n > 0 && count >= n && code[count - 1].op == PUSH_CONST && (n == 1 || code[count - 2].op == PUSH_CONST))
+        {
+            const float a = code[count - n].value;
+            const float b = code[count - 1].value;
+            count -= n;
+            depth -= n;
+            return emit(PUSH_CONST, applyScalar(op, a, b));
+        }
+
+        // The usual x^2 without pow()
+        if (op == POW && code[count - 1].op == PUSH_CONST && code[count - 1].value == 2.f)
+        {
+            count--;
+            depth--;
+            return emit(SQUARE);
+        }
+
+        if (count == MAX_INSTRUCTIONS)
+            return fail("Formula is too long");
+        code[count++] = { op, value };
+        depth += 1 - n;
+        if (depth > MAX_STACK)
+            fail("Formula is nested too deeply");
+    }
+
+    void sum()
+    {
+        product();
+        while (ok)
+        {
+            if (accept('+'))      { product(); emit(ADD); }
+            else if (accept('-')) { product(); emit(SUB); }
+            else break;
+        }
+    }
+
+    void product()
+    {
+        unary();
+        while (ok)
+        {
+            if (accept('*'))      { unary(); emit(MUL); }
+            else if (accept('/')) { unary(); emit(DIV); }
+            else break;
+        }
+    }
+
+    void unary()
+    {
+        // Every recursion passes here
+        if (!ok) return;
+        if (nesting == MAX_NESTING)
+            return fail("Formula is nested too deeply");
+        nesting++;
+
+        if (accept('-'))      { unary(); emit(NEG); }
+        else if (accept('+')) unary();
+        else                  power();
+
+        nesting--;
+    }
+
+    void power()
+    {
+        primary();
+        // Right associative, 2^-x is allowed
+        if (ok && accept('^')) { unary(); emit(POW); }
+    }
+
+    void primary()
+    {
+        skipSpaces();
+        if (!ok) return;
+        if (pos >= text.size())
+            return fail("Unexpected end of formula");
+
+        const char c = text[pos];
+        if (isDigit(pos) || c == '.')
+            return number();
+        if (std::isalpha(static_cast<unsigned char>(c)))
+            return name();
+        if (accept('('))
+        {
+            sum();
+            if (ok && !accept(')'))
+                fail("Missing \")\"");
+            return;
+        }
+        fail("Unexpected \"" + String(std::string(1, c)) + "\"");
+    }
+
+    // Parsed by hand: independent of the locale's decimal separator
+    void number()
+    {
+        const size_t start = pos;
+        double value = 0;
+        while (isDigit(pos))
+            value = value * 10 + (text[pos++] - '0');
+
+        if (pos < text.size() && text[pos] == '.')
+        {
+            pos++;
+            double place = 0.1;
+            while (isDigit(pos))
+            {
+                value += place * (text[pos++] - '0');
+                place *= 0.1;
+            }
+        }
+        if (pos == start + 1 && text[start] == '.')
+            return fail("Invalid number");
+
+        // Exponent, only if digits follow (otherwise "e" is the constant)
+        if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E'))
+        {
+            const bool sign = pos + 1 < text.size() && (text[pos + 1] == '-' || text[pos + 1] == '+');
+            if (isDigit(pos + (sign ? 2 : 1)))
+            {
+                const bool negative = sign && text[pos + 1] == '-';
+                pos += sign ? 2 : 1;
+                int exponent = 0;
+                while (isDigit(pos))
+                    exponent = std::min(exponent * 10 + (text[pos++] - '0'), 100);
+                value *= std::pow(10.0, negative ? -exponent : exponent);
+            }
+        }
+        emit(PUSH_CONST, static_cast<float>(value));
+    }
+
+    void name()
+    {
+        const size_t start = pos;
+        while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+            pos++;
+        const std::string word = text.substr(start, pos - start);
+
+        if (word == "x")     return emit(PUSH_X);
+        if (word == "shift") return emit(PUSH_SHIFT);
+        if (word == "scale") return emit(PUSH_SCALE);
+        if (word == "pi")    return emit(PUSH_CONST, MathConstants<float>::pi);
+        if (word == "e")     return emit(PUSH_CONST, MathConstants<float>::euler);
+
+        for (const auto& [functionName, op] : FUNCTIONS)
+        {
+            if (word != functionName) continue;
+
+            if (!accept('('))
+                return fail("Missing \"(\" after " + String(word));
+            sum();
+            for (int i = 1; i < arity(op) && ok; i++)
+            {
+                if (!accept(','))
+                    return fail(String(word) + " needs " + String(arity(op)) + " arguments");
+                sum();
+            }
+            if (ok && !accept(')'))
+                return fail("Missing \")\" after the arguments of " + String(word));
+            return emit(op);
+        }
+
+        pos = start;
+        fail("Unknown name \"" + String(word) + "\"");
+    }
+};
+
+Result Formula::compile(const String& text, Formula& result)
+{
+    if (text.length() > MAX_LENGTH)
+        return Result::fail("Formula is too long (at most " + String(MAX_LENGTH) + " characters)");
+
+    Compiler compiler(text.toStdString());
+
+    compiler.skipSpaces();
+    if (compiler.pos < compiler.text.size())
+        compiler.sum();
+    compiler.skipSpaces();
+    if (compiler.ok && compiler.pos < compiler.text.size())
+        compiler.fail("Unexpected \"" + String(compiler.text.substr(compiler.pos, 1)) + "\"");
+
+    if (!compiler.ok)
+        return Result::fail(compiler.error);
+
+    // FNV-1a over the program: equal programs get equal hashes, an empty formula has hash 0
+    Formula& formula = compiler.formula;
+    formula.hash = 0;
+    if (!formula.isEmpty())
+    {
+        formula.hash = 14695981039346656037ull;
+        for (int i = 0; i < formula.numInstructions; i++)
+        {
+            uint32 valueBits;
+            std::memcpy(&valueBits, &formula.code[i].value, sizeof(valueBits));
+            for (const uint32 word : { static_cast<uint32>(formula.code[i].op), valueBits })
+            {
+                formula.hash ^= word;
+                formula.hash *= 1099511628211ull;
+            }
+        }
+    }
+
+    result = formula;
+    return Result::ok();
+}
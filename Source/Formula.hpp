@@ -0,0 +1,66 @@
+//
+//  Formula.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include <array>
+
+/**
+ A user formula f(x) for the wave or a potential (wave type "Custom"), compiled to stack bytecode.
+
+ Syntax: numbers, the variables x (0..1 across the table), shift and scale (the sliders, -1..1), the constants pi and e,
+ + - * / ^ (right associative), parentheses and the functions sin cos tan exp log sqrt abs floor min max pow.
+
+ compile() parses on the message thread (allocates), folds constant subexpressions and turns x^2 into a multiplication.
+ The program itself has a fixed size and holds no pointers, so it can be copied to any thread. evaluate() runs every
+ instruction over the whole table at once (the arithmetic vectorizes like the built-in shapes), does not allocate and
+ is bounded by MAX_INSTRUCTIONS.
+ */
+class Formula
+{
+public:
+    static constexpr int MAX_INSTRUCTIONS = 64;
+    static constexpr int MAX_STACK = 8;
+    static constexpr size_t SIZE = 128;         // = Wavetable::SIZE (checked in Wavetable.cpp)
+    static constexpr int MAX_LENGTH = 512;      // characters, longer texts (e.g. from a preset) are rejected
+
+    // Parses text into result. On failure, result is unchanged and the message says what is wrong
+    static Result compile(const String& text, Formula& result);
+
+    // Writes SIZE values to out, non-finite values become 0. An empty formula is 0 everywhere
+    void evaluate(float shift, float scale, float* out) const;
+
+    inline bool isEmpty() const { return numInstructions == 0; }
+    // Hash of the compiled program, identifies the shape in caches
+    inline uint64 getHash() const { return hash; }
+
+private:
+    enum Op : uint8
+    {
+        PUSH_CONST, PUSH_X, PUSH_SHIFT, PUSH_SCALE,
+        ADD, SUB, MUL, DIV, POW, MIN, MAX,
+        NEG, SQUARE, SIN, COS, TAN, EXP, LOG, SQRT, ABS, FLOOR
+    };
+
+    struct Instruction
+    {
+        Op op = PUSH_CONST;
+        float value = 0;    // PUSH_CONST only
+    };
+
+    std::array<Instruction, MAX_INSTRUCTIONS> code{};
+    int numInstructions = 0;
+    uint64 hash = 0;
+
+    struct Compiler;
+
+    template <Op op> static inline float apply(float a, float b);
+    template <Op op> static inline void applyToTable(float* a, const float* b);
+    static float applyScalar(Op op, float a, float b);
+    static int arity(Op op);
+};
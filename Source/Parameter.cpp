@@ -10,14 +10,17 @@
 
 #include "Parameter.h"
 #include "Wavetable.hpp"
+#include "DerivedTables.hpp"
 
-#define FLOAT_PARAM(paramName, range, baseValue) layout.add(std::make_unique<AudioParameterFloat>(ParameterID { (paramName), PARAM_VERSION }, (paramName), (range), (baseValue)))
+#define FLOAT_PARAM_V(paramName, version, range, baseValue) layout.add(std::make_unique<AudioParameterFloat>(ParameterID { (paramName), (version) }, (paramName), (range), (baseValue)))
+#define FLOAT_PARAM(paramName, range, baseValue) FLOAT_PARAM_V(paramName, PARAM_VERSION, range, baseValue)
 
-#define BOOL_PARAM(paramName, baseValue) layout.add(std::make_unique<AudioParameterBool>(ParameterID { (paramName), PARAM_VERSION }, (paramName), (baseValue)))
+#define BOOL_PARAM_V(paramName, version, baseValue) layout.add(std::make_unique<AudioParameterBool>(ParameterID { (paramName), (version) }, (paramName), (baseValue)))
+#define BOOL_PARAM(paramName, baseValue) BOOL_PARAM_V(paramName, PARAM_VERSION, baseValue)
 
-#define CHOICE_PARAM(paramName, choices, baseValue) layout.add(std::make_unique<AudioParameterChoice>(ParameterID{ (paramName), PARAM_VERSION }, (paramName), (choices), (baseValue)));
+#define CHOICE_PARAM_V(paramName, version, choices, baseValue) layout.add(std::make_unique<AudioParameterChoice>(ParameterID{ (paramName), (version) }, (paramName), (choices), (baseValue)));
+#define CHOICE_PARAM(paramName, choices, baseValue) CHOICE_PARAM_V(paramName, PARAM_VERSION, choices, baseValue)
 
-#define GET(paramName) treeState.getRawParameterValue(paramName)->load()
 
 
 const StringArray Parameter::WAVE_TYPES = {
@@ -27,7 +30,8 @@ const StringArray Parameter::WAVE_TYPES = {
     "Parabola",
     "Barrier",
     "Sawtooth",
-    "Square"
+    "Square",
+    "Custom"
 };
 
 const StringArray Parameter::SAMPLE_TYPES = {
@@ -36,6 +40,29 @@ const StringArray Parameter::SAMPLE_TYPES = {
     "Squared Absolute"
 };
 
+const StringArray Parameter::INTERPOLATION_TYPES = {
+    "Linear",
+    "Hermite (4 point)",
+    "Polynomial (6 point)"
+};
+
+const std::array<const char*, Parameter::NUM_RAW_VALUES> Parameter::RAW_IDS = {
+    GAIN, VOICE_COUNT, PORTAMENTO, INTERNAL_RATE,
+    ATTACK_TIME, DECAY_TIME, RELEASE_TIME, SUSTAIN_LEVEL,
+    WAVE_TYPE, WAVE_SHIFT, WAVE_SCALE,
+    POTENTIAL_TYPE1, POTENTIAL_SHIFT1, POTENTIAL_SCALE1, POTENTIAL_AMOUNT1,
+    POTENTIAL_TYPE2, POTENTIAL_SHIFT2, POTENTIAL_SCALE2, POTENTIAL_AMOUNT2,
+    POTENTIAL_VELOCITY, POTENTIAL_PRESSURE, POTENTIAL_LFO_RATE, POTENTIAL_LFO_DEPTH,
+    APPLY_WAVEFUNC, ACCURACY, SIMULATION_SPEED, SIMULATION_OFFSET,
+    SAMPLE_TYPE, SHOW_FFT, INTERPOLATION,
+    FILTER_FREQUENCY, FILTER_RESONANCE, FILTER_ENVELOPE,
+    STEREO_AMOUNT, REVERB_MIX
+};
+
+const std::array<const char*, Parameter::NUM_FORMULAS> Parameter::FORMULA_IDS = {
+    WAVE_FORMULA, POTENTIAL_FORMULA1, POTENTIAL_FORMULA2
+};
+
 AudioProcessorValueTreeState::ParameterLayout Parameter::createParameterLayout() {
     AudioProcessorValueTreeState::ParameterLayout layout;
     
@@ -45,6 +72,7 @@ AudioProcessorValueTreeState::ParameterLayout Parameter::createParameterLayout()
     FLOAT_PARAM(GAIN, NormalisableRange<float>(-64.f, 0.f, 0.1f, 0.9f, true), -24.f);
     FLOAT_PARAM(VOICE_COUNT, NormalisableRange<float>(1.f, 64.f, 1.f, 0.4f, false), 16.f);
     FLOAT_PARAM(PORTAMENTO, NormalisableRange<float>(0.f, 5.f, 0.001f, 0.25f, false), 0.f);
+    BOOL_PARAM_V(INTERNAL_RATE, PARAM_VERSION_2, false);
     
     FLOAT_PARAM(ATTACK_TIME, NormalisableRange<float>(0.001f, 16.f, 0.001f, 0.3f, false), 0.08f);
     FLOAT_PARAM(DECAY_TIME, NormalisableRange<float>(0.001f, 16.f, 0.001f, 0.3f, false), 0.5f);
@@ -70,11 +98,16 @@ AudioProcessorValueTreeState::ParameterLayout Parameter::createParameterLayout()
     FLOAT_PARAM(POTENTIAL_SHIFT2, NormalisableRange<float>(-1.f, 1.f, 0.01f, 1.f, true), 0.f);
     FLOAT_PARAM(POTENTIAL_SCALE2, NormalisableRange<float>(-1.f, 1.f, 0.01f, 1.f, true), 0.f);
     FLOAT_PARAM(POTENTIAL_AMOUNT2, NormalisableRange<float>(-100.f, 100.f, 0.01f, .25f, true), 0.f);
+    FLOAT_PARAM_V(POTENTIAL_VELOCITY, PARAM_VERSION_2, NormalisableRange<float>(-1.f, 1.f, 0.01f, 1.f, true), 0.f);
+    FLOAT_PARAM_V(POTENTIAL_PRESSURE, PARAM_VERSION_2, NormalisableRange<float>(-1.f, 1.f, 0.01f, 1.f, true), 0.f);
+    FLOAT_PARAM_V(POTENTIAL_LFO_RATE, PARAM_VERSION_2, NormalisableRange<float>(0.01f, 20.f, 0.01f, 0.3f, false), 1.f);
+    FLOAT_PARAM_V(POTENTIAL_LFO_DEPTH, PARAM_VERSION_2, NormalisableRange<float>(0.f, 1.f, 0.01f, 1.f, false), 0.f);
     
     CHOICE_PARAM(SAMPLE_TYPE, SAMPLE_TYPES, SampleType::SQARED_ABS);
     
 
     BOOL_PARAM(SHOW_FFT, false);
+    CHOICE_PARAM_V(INTERPOLATION, PARAM_VERSION_2, INTERPOLATION_TYPES, Interpolation::LINEAR);
     
     // Filter
     FLOAT_PARAM(FILTER_FREQUENCY, NormalisableRange<float>(30.f, 20000.f, 1.f, .25f, false), 20000.f);
@@ -90,61 +123,222 @@ AudioProcessorValueTreeState::ParameterLayout Parameter::createParameterLayout()
     return layout;
 }
 
-void Parameter::update(AudioProcessorValueTreeState& treeState, float sampleRate)
+Parameter::~Parameter()
+{
+    if (attachedState != nullptr)
+        for (const auto* id : RAW_IDS)
+            attachedState->removeParameterListener(id, this);
+}
+
+void Parameter::attach(AudioProcessorValueTreeState& treeState)
+{
+    if (attachedState != nullptr)
+        for (const auto* id : RAW_IDS)
+            attachedState->removeParameterListener(id, this);
+    
+    attachedState = &treeState;
+    for (int i = 0; i < NUM_RAW_VALUES; i++) {
+        rawValue[i] = treeState.getRawParameterValue(RAW_IDS[i]);
+        jassert(rawValue[i] != nullptr);
+        treeState.addParameterListener(RAW_IDS[i], this);
+    }
+    loadFormulas();
+    
+    if (tableBuilder == nullptr) {
+        tableBuilder = std::make_unique<TableBuilder>();
+        postedInputs = std::make_unique<TableInputs>();
+    }
+}
+
+void Parameter::postTableInputs()
+{
+    TableInputs inputs;
+    inputs.potentialType    = { value[RAW_POTENTIAL_TYPE1],   value[RAW_POTENTIAL_TYPE2] };
+    inputs.potentialShift   = { value[RAW_POTENTIAL_SHIFT1],  value[RAW_POTENTIAL_SHIFT2] };
+    inputs.potentialScale   = { value[RAW_POTENTIAL_SCALE1],  value[RAW_POTENTIAL_SCALE2] };
+    inputs.potentialAmount  = { value[RAW_POTENTIAL_AMOUNT1], value[RAW_POTENTIAL_AMOUNT2] };
+    inputs.timestepDelta    = timestepDelta;
+    inputs.stereoAmount     = value[RAW_STEREO_AMOUNT] * 0.01f;
+    inputs.waveTypeNumber   = waveTypeNumber;
+    inputs.waveShift        = waveShift;
+    inputs.waveScale        = waveScale;
+    inputs.sampleType       = sampleType;
+    inputs.potentialFormula = { (*formulas)[FORMULA_POTENTIAL1], (*formulas)[FORMULA_POTENTIAL2] };
+    inputs.waveFormula      = (*formulas)[FORMULA_WAVE];
+    
+    // The first tables are built right away, so the audio thread never sees empty ones
+    if (tables == nullptr)
+        tableBuilder->start(inputs);
+    else if (inputs != *postedInputs)
+        tableBuilder->post(inputs);
+    
+    *postedInputs = inputs;
+}
+
+void Parameter::swapTables()
+{
+    tables = &tableBuilder->getTables();
+
+    // From the published dt, so the step rate switches together with the phase factors of a new dt
+    samplesPerTimestep = samplesPerSimulatedSecond * tables->timestepDelta;
+}
+
+// Formulas ---------------------------------------------------------------------------------------------------------------------------
+//
+
+Result Parameter::setFormula(const FormulaTarget target, const String& text)
+{
+    Formula formula;
+    const auto result = Formula::compile(text, formula);
+    if (result.failed())
+        return result;
+    
+    if (attachedState != nullptr)
+        attachedState->state.setProperty(FORMULA_IDS[target], text, nullptr);
+    
+    const SpinLock::ScopedLockType lock(formulaWriteLock);
+    compiledFormulas[target] = formula;
+    publishFormulas();
+    return result;
+}
+
+String Parameter::getFormulaText(const FormulaTarget target) const
+{
+    if (attachedState == nullptr)
+        return {};
+    return attachedState->state.getProperty(FORMULA_IDS[target]).toString();
+}
+
+void Parameter::loadFormulas()
 {
-    gainFactor = Decibels::decibelsToGain(GET(GAIN));
-    numVoices = GET(VOICE_COUNT);
-    portamentoTime = GET(PORTAMENTO);
+    if (attachedState == nullptr)
+        return;
+    
+    const SpinLock::ScopedLockType lock(formulaWriteLock);
+    for (int i = 0; i < NUM_FORMULAS; i++)
+    {
+        compiledFormulas[i] = Formula();
+        Formula::compile(getFormulaText(static_cast<FormulaTarget>(i)), compiledFormulas[i]);
+    }
+    publishFormulas();
+}
+
+void Parameter::publishFormulas()
+{
+    formulaBuffer.getWriteBuffer() = compiledFormulas;
+    formulaBuffer.publish();
+    // The audio thread picks them up on its next update and posts them to the TableBuilder
+    invalidate();
+}
+
+ParameterSnapshot::Ptr Parameter::getSnapshot() const
+{
+    return tableBuilder->getSnapshot();
+}
+
+void Parameter::invalidate()
+{
+    changeCount++;
+}
+
+void Parameter::parameterChanged(const String&, float)
+{
+    changeCount++;
+}
+
+bool Parameter::changed(std::initializer_list<RawValue> ids) const
+{
+    for (const auto id : ids)
+        if (value[id] != lastValue[id])
+            return true;
+    return false;
+}
+
+void Parameter::update(AudioProcessorValueTreeState& treeState, float sampleRate, int qualityLevel)
+{
+    if (attachedState != &treeState)
+        attach(treeState);
+    
+    // Nothing changed since the last update
+    const uint32 currentChangeCount = changeCount.load(std::memory_order_acquire);
+    if (currentChangeCount == seenChangeCount && sampleRate == lastSampleRate && qualityLevel == lastQualityLevel) {
+        swapTables();
+        return;
+    }
+    
+    // Read the count before the values: a change during this update is picked up by the next one
+    seenChangeCount = currentChangeCount;
+    if (sampleRate != lastSampleRate || qualityLevel != lastQualityLevel)
+        lastValue.fill(std::numeric_limits<float>::quiet_NaN());
+    lastSampleRate = sampleRate;
+    lastQualityLevel = qualityLevel;
+    
+    for (int i = 0; i < NUM_RAW_VALUES; i++)
+        value[i] = rawValue[i]->load(std::memory_order_relaxed);
+    
+    // Formulas are published before the change count is incremented, so they are up to date here
+    formulas = &formulaBuffer.read();
+    waveFormula = &(*formulas)[FORMULA_WAVE];
+    
+    gainFactor = Decibels::decibelsToGain(value[RAW_GAIN]);
+    numVoices = value[RAW_VOICE_COUNT];
+    portamentoTime = value[RAW_PORTAMENTO];
+    internalRate = value[RAW_INTERNAL_RATE];
     
     // Envelope
-    attackFactor = 1 - std::pow(ATTACK_THRESHOLD, 1 / (sampleRate * GET(ATTACK_TIME)));
-    decayFactor = 1 - std::pow(DECAY_THRESHOLD, 1 / (sampleRate * GET(DECAY_TIME)));
-    releaseFactor = std::pow(RELEASE_THRESHOLD, 1 / (sampleRate * GET(RELEASE_TIME)));
-    sustainLevel = GET(SUSTAIN_LEVEL);
+    if (changed({ RAW_ATTACK_TIME }))
+        attackFactor = 1 - std::pow(ATTACK_THRESHOLD, 1 / (sampleRate * value[RAW_ATTACK_TIME]));
+    if (changed({ RAW_DECAY_TIME }))
+        decayFactor = 1 - std::pow(DECAY_THRESHOLD, 1 / (sampleRate * value[RAW_DECAY_TIME]));
+    if (changed({ RAW_RELEASE_TIME }))
+        releaseFactor = std::pow(RELEASE_THRESHOLD, 1 / (sampleRate * value[RAW_RELEASE_TIME]));
+    sustainLevel = value[RAW_SUSTAIN_LEVEL];
     
     // Waveforms
-    waveTypeNumber = GET(WAVE_TYPE);
-    waveShift = GET(WAVE_SHIFT);
-    waveScale = GET(WAVE_SCALE);
-
+    waveTypeNumber = value[RAW_WAVE_TYPE];
+    waveShift = value[RAW_WAVE_SHIFT];
+    waveScale = value[RAW_WAVE_SCALE];
     
-    // Simulation
-    applyWavefunction       = GET(APPLY_WAVEFUNC);
-    float accuracy          = GET(ACCURACY);
-    float simulationSpeed   = GET(SIMULATION_SPEED);
+    potentialVelocity = value[RAW_POTENTIAL_VELOCITY];
+    potentialPressure = value[RAW_POTENTIAL_PRESSURE];
+    potentialLfoRate = value[RAW_POTENTIAL_LFO_RATE];
+    potentialLfoDepth = value[RAW_POTENTIAL_LFO_DEPTH];
     
-    // Potential
-    const float potentialAmount1 = GET(POTENTIAL_AMOUNT1);
-    const float potentialAmount2 = GET(POTENTIAL_AMOUNT2);
-    const auto p1 = Wavetable::generate(GET(POTENTIAL_TYPE1), GET(POTENTIAL_SHIFT1), GET(POTENTIAL_SCALE1));
-    const auto p2 = Wavetable::generate(GET(POTENTIAL_TYPE2), GET(POTENTIAL_SHIFT2), GET(POTENTIAL_SCALE2));
-    potential = p1.zip(p2)
-        .mapTo<float>([potentialAmount1, potentialAmount2](cfloat a, cfloat b) 
-            { 
-                return POTENTIAL_SCALE * (potentialAmount1 * std::real(a) + potentialAmount2 * std::real(b));
-            });
+    // Simulation
+    applyWavefunction       = value[RAW_APPLY_WAVEFUNC];
     
-    samplesPerTimestep  = sampleRate / (accuracy * simulationSpeed);
-    timestepDelta       = 1.f / accuracy;
-    preStartTimesteps   = round(GET(SIMULATION_OFFSET) * accuracy);
+    // Reduced quality: fewer but longer timesteps, the simulated speed stays the same
+    if (changed({ RAW_ACCURACY, RAW_SIMULATION_SPEED, RAW_SIMULATION_OFFSET }))
+    {
+        const float accuracy          = value[RAW_ACCURACY];
+        const float simulationSpeed   = value[RAW_SIMULATION_SPEED];
+        
+        this->qualityLevel  = qualityLevel;
+        const float stepRateDivider = static_cast<float>(1 << std::min(qualityLevel, 2));
+        throttleQuietVoices = qualityLevel >= 3;
+        
+        samplesPerSimulatedSecond = sampleRate / simulationSpeed;
+        timestepDelta       = stepRateDivider / accuracy;
+        preStartTimesteps   = round(value[RAW_SIMULATION_OFFSET] * accuracy / stepRateDivider);
+    }
     
-    sampleType  = static_cast<SampleType>(GET(SAMPLE_TYPE));
-    showFFT     = GET(SHOW_FFT);
+    sampleType  = static_cast<SampleType>(value[RAW_SAMPLE_TYPE]);
+    showFFT     = value[RAW_SHOW_FFT];
+    interpolation = static_cast<Interpolation>(value[RAW_INTERPOLATION]);
     
     
     // Filter
-    filterFreq = GET(FILTER_FREQUENCY);
-    filterQ = GET(FILTER_RESONANCE);
-    filterEnvelope = GET(FILTER_ENVELOPE);
+    filterFreq = value[RAW_FILTER_FREQUENCY];
+    filterQ = value[RAW_FILTER_RESONANCE];
+    filterEnvelope = value[RAW_FILTER_ENVELOPE];
 
     
-    //Stereo
-    float stereoAmount = GET(STEREO_AMOUNT) * 0.01f;
-    stereoList = list<float>(Wavetable::SIZE, [stereoAmount](size_t i){
-        return 1 - stereoAmount * 0.5f * (std::tanhf(Wavetable::TWO_PI * (i / Wavetable::SIZE_F - 0.5f)) + 1);
-    });
-    
     // FX
-    reverbMix = GET(REVERB_MIX) * 0.01f;
+    reverbMix = value[RAW_REVERB_MIX] * 0.01f;
+    
+    lastValue = value;
     
+    // Potential, stereo and solver tables and the editor's snapshot: rebuilt by the TableBuilder when their inputs changed
+    postTableInputs();
+    swapTables();
 }
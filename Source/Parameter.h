@@ -11,13 +11,25 @@
 #pragma once
 #include "list.hpp"
 #include <functional>
+#include <array>
+#include <atomic>
 #include <JuceHeader.h>
+#include "Formula.hpp"
+#include "TripleBuffer.h"
+
+struct DerivedTables;
+struct TableInputs;
+struct ParameterSnapshot;
+class TableBuilder;
 
 #define PARAM_VERSION 1
+// Version hint of parameters added after the first release, so hosts keep the indices of the older ones
+#define PARAM_VERSION_2 2
 
 #define GAIN "Gain"
 #define VOICE_COUNT "Number of Voices"
 #define PORTAMENTO "Portamento"
+#define INTERNAL_RATE "Internal 48 kHz"
 
 #define ATTACK_TIME "Attack"
 #define DECAY_TIME "Decay"
@@ -36,6 +48,10 @@
 #define POTENTIAL_SHIFT2 "Potential Shift 2"
 #define POTENTIAL_SCALE2 "Potential Scale 2"
 #define POTENTIAL_AMOUNT2 "Potential Amount 2"
+#define POTENTIAL_VELOCITY "Potential Velocity"
+#define POTENTIAL_PRESSURE "Potential Pressure"
+#define POTENTIAL_LFO_RATE "Potential LFO Rate"
+#define POTENTIAL_LFO_DEPTH "Potential LFO Depth"
 
 #define APPLY_WAVEFUNC "Schroedinger"
 #define ACCURACY "Timesteps / Simulated sec"
@@ -43,6 +59,7 @@
 #define SIMULATION_OFFSET "Pre-start simulated sec"
 #define SAMPLE_TYPE "Sample Type"
 #define SHOW_FFT "FFT"
+#define INTERPOLATION "Interpolation"
 
 #define FILTER_FREQUENCY "Filter Frequency"
 #define FILTER_RESONANCE "Filter Resonance"
@@ -53,6 +70,11 @@
 
 #define REVERB_MIX "Reverb Mix"
 
+// Formulas for the custom wave type are stored as properties of the state tree, not as parameters
+#define WAVE_FORMULA "Wave Formula"
+#define POTENTIAL_FORMULA1 "Potential Formula 1"
+#define POTENTIAL_FORMULA2 "Potential Formula 2"
+
 typedef std::complex<float> cfloat;
 
 enum WaveType
@@ -63,7 +85,8 @@ enum WaveType
     PARABOLA,
     BARRIER,
     SAWTOOTH,
-    SQUARE
+    SQUARE,
+    CUSTOM          // user formula, see Formula
 };
 
 enum SampleType
@@ -74,19 +97,37 @@ enum SampleType
     SQARED_ABS
 };
 
+enum Interpolation
+{
+    // on update: check strings in layout creation!
+    LINEAR,
+    HERMITE_4,
+    POLYNOMIAL_6
+};
+
 /**
  struct to communicate Parameter between Front- and Backend. General Idea:  struct "Parameter" contains only processed values which not necessarily correspond 1:1 to the Parameters of the Front-End
+
+ The raw parameter handles are resolved on the first update, which also registers a listener for every parameter.
+ Later updates return immediately when no listener fired, otherwise only the values whose inputs changed are recomputed.
  */
-class Parameter
+class Parameter : private AudioProcessorValueTreeState::Listener
 {
 public:
+    Parameter() = default;
+    ~Parameter() override;
+
     // Envelope Constants
     static constexpr float ATTACK_THRESHOLD = 0.01f;
     static constexpr float DECAY_THRESHOLD = 0.00001f;
     static constexpr float RELEASE_THRESHOLD = 0.00001f;
 
+    // Voices quieter than this stop simulating on the lowest quality level (-40 dB)
+    static constexpr float QUIET_VOICE_LEVEL = 0.01f;
+
     static const StringArray WAVE_TYPES;
     static const StringArray SAMPLE_TYPES;
+    static const StringArray INTERPOLATION_TYPES;
 
     static constexpr float POTENTIAL_SCALE = 1.f;
 
@@ -94,6 +135,7 @@ public:
     float gainFactor = 0;
     float numVoices = 3;
     float portamentoTime = 0.5;
+    bool internalRate = false;      // Voices run at QSynthi::INTERNAL_SAMPLE_RATE on hosts above it, then get resampled
 
     // Envelope
     float attackFactor = 0;
@@ -111,21 +153,54 @@ public:
     float waveShift = 0;
     float waveScale = 0;
 
+    // Per-voice potential modulation: each voice's potential is scaled by
+    // (1 + velocity * (2 v - 1)) * (1 + pressure * p) * (1 + lfoDepth * sin(lfo)), v and p in 0..1
+    float potentialVelocity = 0;
+    float potentialPressure = 0;
+    float potentialLfoRate = 1;     // Hz
+    float potentialLfoDepth = 0;
+    bool isPotentialModulated() const { return potentialVelocity != 0 || potentialPressure != 0 || potentialLfoDepth != 0; }
+
 
     // For Schroedinger
     bool applyWavefunction = false; // True if Schrödinger's equation should be applied to waveform
 
     float samplesPerTimestep = 0;   // Number of timesteps which get performed after a sample is calculated. Always > 0, could get > 1
-    float timestepDelta = 0;        // Time duration of each timestep
+    float timestepDelta = 0;        // Time duration of each timestep (requested, the tables follow a little later)
     size_t preStartTimesteps = 0;
 
-    // Values per Wavetable for each
-    list<float> potential;
+    // Set by the QualityGovernor on overload
+    int qualityLevel = 0;
+    bool throttleQuietVoices = false;   // True if quiet voices should pause their simulation
+
+    // Potential, stereo weights and solver phase factors, rebuilt off the audio thread (see TableBuilder).
+    // Swapped in by update(), stays valid until the next update
+    const DerivedTables* tables = nullptr;
+
+    // Consistent, immutable view for the editor. Never call from the audio thread
+    ReferenceCountedObjectPtr<ParameterSnapshot> getSnapshot() const;
+
+    // Formulas for WaveType::CUSTOM
+    enum FormulaTarget { FORMULA_WAVE, FORMULA_POTENTIAL1, FORMULA_POTENTIAL2, NUM_FORMULAS };
+    static const std::array<const char*, NUM_FORMULAS> FORMULA_IDS;
+
+    // Message thread: compiles the formula, stores its text in the state and hands the program to the audio thread.
+    // Nothing changes if the formula has an error
+    Result setFormula(FormulaTarget target, const String& text);
+    String getFormulaText(FormulaTarget target) const;
+    // Compiles the formulas stored in the state again, e.g. after it was replaced. Formulas with errors become empty
+    void loadFormulas();
+
+    // Compiled wave formula, swapped in by update() and valid until the next one (the potential formulas go to the TableBuilder)
+    const Formula* waveFormula = nullptr;
 
     SampleType sampleType;          // for default value, go to layout creation
     bool showFFT = false;           // True if the FFT of the waveform should be played
+    Interpolation interpolation = LINEAR;       // Wavetable readout
 
-    std::function<float(cfloat)> getSampleConverter() const
+    std::function<float(cfloat)> getSampleConverter() const { return getSampleConverter(sampleType); }
+
+    static std::function<float(cfloat)> getSampleConverter(const SampleType sampleType)
     {
         if (sampleType == REAL_VALUE) return [](const cfloat z) { return std::real(z); };
         if (sampleType == IMAG_VALUE) return [](const cfloat z) { return std::imag(z); };
@@ -135,12 +210,58 @@ public:
 
 
     static AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
-    void update(AudioProcessorValueTreeState& getParameter, float sampleRate);
-    
-    
-    // Stereo
-    list<float> stereoList;
+    // The first call attaches to treeState and should happen on the message thread (e.g. in the processor's constructor)
+    void update(AudioProcessorValueTreeState& treeState, float sampleRate, int qualityLevel = 0);
+    // Forces the next update to check all values, e.g. after the state was replaced. Can be called from any thread
+    void invalidate();
     
     // FX
     float reverbMix = 0;
+
+private:
+    // Index of every raw parameter, see RAW_IDS
+    enum RawValue
+    {
+        RAW_GAIN, RAW_VOICE_COUNT, RAW_PORTAMENTO, RAW_INTERNAL_RATE,
+        RAW_ATTACK_TIME, RAW_DECAY_TIME, RAW_RELEASE_TIME, RAW_SUSTAIN_LEVEL,
+        RAW_WAVE_TYPE, RAW_WAVE_SHIFT, RAW_WAVE_SCALE,
+        RAW_POTENTIAL_TYPE1, RAW_POTENTIAL_SHIFT1, RAW_POTENTIAL_SCALE1, RAW_POTENTIAL_AMOUNT1,
+        RAW_POTENTIAL_TYPE2, RAW_POTENTIAL_SHIFT2, RAW_POTENTIAL_SCALE2, RAW_POTENTIAL_AMOUNT2,
+        RAW_POTENTIAL_VELOCITY, RAW_POTENTIAL_PRESSURE, RAW_POTENTIAL_LFO_RATE, RAW_POTENTIAL_LFO_DEPTH,
+        RAW_APPLY_WAVEFUNC, RAW_ACCURACY, RAW_SIMULATION_SPEED, RAW_SIMULATION_OFFSET,
+        RAW_SAMPLE_TYPE, RAW_SHOW_FFT, RAW_INTERPOLATION,
+        RAW_FILTER_FREQUENCY, RAW_FILTER_RESONANCE, RAW_FILTER_ENVELOPE,
+        RAW_STEREO_AMOUNT, RAW_REVERB_MIX,
+        NUM_RAW_VALUES
+    };
+    static const std::array<const char*, NUM_RAW_VALUES> RAW_IDS;
+
+    AudioProcessorValueTreeState* attachedState = nullptr;
+    std::array<std::atomic<float>*, NUM_RAW_VALUES> rawValue{};
+    std::array<float, NUM_RAW_VALUES> value{};
+    std::array<float, NUM_RAW_VALUES> lastValue{};     // values of the last update, NaN forces a recompute
+
+    std::atomic<uint32> changeCount{ 0 };   // incremented by the listener
+    uint32 seenChangeCount = 0;
+    float lastSampleRate = 0;
+    int lastQualityLevel = -1;
+
+    std::unique_ptr<TableBuilder> tableBuilder;
+    std::unique_ptr<TableInputs> postedInputs;
+
+    // Compiled formulas: written under formulaWriteLock (message thread, state restore), read by update()
+    TripleBuffer<std::array<Formula, NUM_FORMULAS>> formulaBuffer;
+    std::array<Formula, NUM_FORMULAS> compiledFormulas;
+    SpinLock formulaWriteLock;
+    const std::array<Formula, NUM_FORMULAS>* formulas = nullptr;
+
+    // samplesPerTimestep is derived from the published tables' dt in swapTables()
+    float samplesPerSimulatedSecond = 0;
+
+    void attach(AudioProcessorValueTreeState& treeState);
+    void postTableInputs();
+    void swapTables();
+    void publishFormulas();
+    bool changed(std::initializer_list<RawValue> ids) const;
+    void parameterChanged(const String& parameterID, float newValue) override;
 };
@@ -45,36 +45,102 @@ void CustomLabel::resized()
 }
 
 
+FormulaEditor::FormulaEditor(QSynthiAudioProcessor& p, const Parameter::FormulaTarget target, const String& typeParameter, const String& placeholder)
+: TextEditor(typeParameter), p(p), target(target), typeParameter(typeParameter)
+{
+    setTextToShowWhenEmpty(placeholder, Colour(0x99FFFFFF));
+    setInputRestrictions(Formula::MAX_LENGTH);
+    setText(p.parameter->getFormulaText(target), false);
+    
+    onReturnKey = [this]() { apply(); };
+    onFocusLost = [this]() { apply(); };
+    onEscapeKey = [this]() {
+        setText(this->p.parameter->getFormulaText(this->target), false);
+        showError({});
+        unfocusAllComponents();
+    };
+}
+
+void FormulaEditor::apply()
+{
+    showError(p.parameter->setFormula(target, getText()).getErrorMessage());
+}
+
+void FormulaEditor::showError(const String& message)
+{
+    error = message;
+    const Colour outline = error.isEmpty() ? Colour(0x00000000) : Colour(0xFFFF3747);
+    setColour(TextEditor::outlineColourId, outline);
+    setColour(TextEditor::focusedOutlineColourId, outline);
+}
+
+void FormulaEditor::update()
+{
+    setVisible(p.treeState.getRawParameterValue(typeParameter)->load() == WaveType::CUSTOM);
+    
+    // Keep what the user is typing and formulas with errors
+    const String stored = p.parameter->getFormulaText(target);
+    if (!hasKeyboardFocus(false) && error.isEmpty() && getText() != stored)
+        setText(stored, false);
+}
+
+
 void WaveTableComponent::paint(Graphics& g)
 {
+    // One consistent set of values for the whole frame
+    const auto snapshot = p.parameter->getSnapshot();
+    
     g.fillAll(Colour(0xff141010));
     
     // Draw Potential
     ColourGradient potentialGradient (Colour(0xFF43F7B9), 0.55f * getBounds().getWidth(), 0.25f * getBounds().getHeight(), Colour(0xFF4618D8), 0.45f * getBounds().getWidth(), 1.f * getBounds().getHeight(), false);
     potentialGradient.addColour(0.4, Colour(0xFF00D1BB));
-    drawLine(g, getBounds(), p.parameter->potential, potentialGradient);
+    drawLine(g, getBounds(), snapshot->potential, potentialGradient);
     
     
     // Draw Wave
     ColourGradient waveGradient (Colour(0xFFF7BD2A), 0.55f * getBounds().getWidth(), 0.25f * getBounds().getHeight(), Colour(0xFFFF3747), 0.45f * getBounds().getWidth(), getBounds().getHeight(), false);
     waveGradient.addColour(0.5, Colour(0xFFFF7738));
     
-    list<cfloat> waveTable;
-    const auto sampleConversion = p.parameter->getSampleConverter();
+    const auto sampleConversion = snapshot->getSampleConverter();
 
-    if (p.synth->hasDisplayedWavetable())
-        waveTable = p.synth->getDisplayedWavetable();
-    else
-        waveTable = Wavetable::generate(p.parameter->waveTypeNumber, p.parameter->waveShift, p.parameter->waveScale);
+    list<cfloat> waveTable = p.synth->getDisplayedWavetable();
+    if (waveTable.length() == 0)
+    {
+        const cfloat* values = waveCache.generate(snapshot->waveTypeNumber, snapshot->waveShift, snapshot->waveScale, &snapshot->waveFormula);
+        waveTable = list<cfloat>(std::vector<cfloat>(values, values + Wavetable::SIZE));
+    }
     
     drawLine(g, getBounds(), waveTable.mapTo(sampleConversion), waveGradient);
     
+    // Show reduced simulation quality (CPU overload)
+    const int qualityLevel = p.governor.getQualityLevel();
+    if (qualityLevel > 0)
+    {
+        g.setColour(Colour(0x99FFFFFF));
+        g.setFont(getHeight() / 20.f);
+        g.drawText("Reduced simulation quality (CPU load) " + String(qualityLevel) + "/" + String(QualityGovernor::MAX_LEVEL),
+                   getLocalBounds().reduced(getWidth() / 70, getHeight() / 25), Justification::bottomRight);
+    }
+    
+    // Formula errors next to their fields
+    g.setColour(Colour(0xFFFF3747));
+    g.setFont(getHeight() / 20.f);
+    formulaEditors.forEach([this, &g](auto* f) {
+        if (f->isVisible() && f->getError().isNotEmpty())
+            g.drawText(f->getError(), f->getBounds().withX(f->getRight() + getWidth() / 70).withRight(getWidth()), Justification::centredLeft);
+    });
 }
 
 void WaveTableComponent::resized()
 {
     Component::resized();
     logo.setBounds(getWidth()/70, getHeight()/25, getWidth(), getHeight()/7);
+    
+    // Formula fields at the bottom left, the wave on top
+    auto area = getLocalBounds().reduced(getWidth() / 70, getHeight() / 25);
+    for (size_t i = formulaEditors.length(); i-- > 0;)
+        formulaEditors[i]->setBounds(area.removeFromBottom(getHeight() / 10).removeFromLeft(getWidth() / 2).reduced(0, 2));
 }
 
 void WaveTableComponent::drawLine(Graphics& g, Rectangle<int> bounds, list<float> values, ColourGradient gradient)
@@ -99,6 +165,7 @@ void WaveTableComponent::drawLine(Graphics& g, Rectangle<int> bounds, list<float
 }
 
 void WaveTableComponent::timerCallback() {
+    formulaEditors.forEach([](auto* f){ f->update(); });
     repaint();
 }
 
@@ -58,6 +58,29 @@ private:
     static Typeface::Ptr getCustomTypeface(int typefaceId);
 };
 
+/**
+ Text field for the formula of a wave or potential, only visible while its type is "Custom".
+ The formula is compiled when return is pressed or the field loses focus; on an error the last working formula stays active.
+ */
+class FormulaEditor : public TextEditor
+{
+public:
+    FormulaEditor(QSynthiAudioProcessor& p, Parameter::FormulaTarget target, const String& typeParameter, const String& placeholder);
+    
+    // Follows the type parameter and formulas that changed elsewhere (e.g. a loaded state)
+    void update();
+    const String& getError() const { return error; }
+    
+private:
+    QSynthiAudioProcessor& p;
+    const Parameter::FormulaTarget target;
+    const String typeParameter;
+    String error;
+    
+    void apply();
+    void showError(const String& message);
+};
+
 class WaveTableComponent : public Component, Timer
 {
 public:
@@ -66,8 +89,14 @@ public:
     WaveTableComponent(QSynthiAudioProcessor& p) : Timer(), p(p)
     {
         startTimerHz(30);
+        p.synth->setDisplayActive(true);
         logo.setImage(ImageFileFormat::loadFrom(BinaryData::logo_png, BinaryData::logo_pngSize), 1);
         addAndMakeVisible(&logo);
+        formulaEditors.forEach([this](auto* f){ this->addChildComponent(f); });
+    }
+    ~WaveTableComponent() override
+    {
+        p.synth->setDisplayActive(false);
     }
   
     void paint(Graphics& g) override;
@@ -78,6 +107,12 @@ private:
     void drawLine(Graphics& g, Rectangle<int> bounds, list<float> values, ColourGradient gradient);
     
     ImageComponent logo;
+    WavetableCache waveCache;
+    
+    FormulaEditor waveFormula{ p, Parameter::FORMULA_WAVE, WAVE_TYPE, "Wave f(x), e.g. exp(-(8*(x - 0.5 - shift/2))^2)" };
+    FormulaEditor potentialFormula1{ p, Parameter::FORMULA_POTENTIAL1, POTENTIAL_TYPE1, "Potential 1 f(x), e.g. (2*x - 1)^2" };
+    FormulaEditor potentialFormula2{ p, Parameter::FORMULA_POTENTIAL2, POTENTIAL_TYPE2, "Potential 2 f(x), e.g. abs(sin(3*pi*x))" };
+    list<FormulaEditor*> formulaEditors{ &waveFormula, &potentialFormula1, &potentialFormula2 };
 };
 
 
@@ -25,10 +25,13 @@ QSynthiAudioProcessor::QSynthiAudioProcessor()
     parameter = new Parameter();
     parameter->update(treeState, 44100.f);
     synth = new QSynthi(parameter);
+    
+    treeState.addParameterListener(VOICE_COUNT, this);
 }
 
 QSynthiAudioProcessor::~QSynthiAudioProcessor()
 {
+    treeState.removeParameterListener(VOICE_COUNT, this);
     delete synth;       synth = nullptr;
     delete parameter;   parameter = nullptr;
 }
@@ -68,7 +71,10 @@ bool QSynthiAudioProcessor::isMidiEffect() const
 
 double QSynthiAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    // The resampler delays the tail by the reported latency
+    const double latency = getSampleRate() > 0 ? getLatencySamples() / getSampleRate() : 0;
+    return QSynthi::getTailLengthSeconds(treeState.getRawParameterValue(RELEASE_TIME)->load(),
+                                         treeState.getRawParameterValue(REVERB_MIX)->load() * 0.01f) + latency;
 }
 
 int QSynthiAudioProcessor::getNumPrograms()
@@ -98,9 +104,9 @@ void QSynthiAudioProcessor::changeProgramName (int index, const String& newName)
 //==============================================================================
 void QSynthiAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-
-
+    governor.prepareToPlay((float) sampleRate);
     synth->prepareToPlay((float) sampleRate);
+    setLatencySamples(synth->getLatencySamples());
 
 }
 
@@ -138,8 +144,11 @@ bool QSynthiAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts)
 
 void QSynthiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer& midiMessages)
 {
-    /*ScopedNoDenormals noDenormals;
-    auto totalNumInputChannels  = getTotalNumInputChannels();
+    // Flush-to-zero for everything below (parameters, voices, filters, reverb): decaying tails never turn subnormal
+    ScopedNoDenormals noDenormals;
+    governor.beginBlock();
+    
+    /*auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
     // In case we have more outputs than inputs, this code clears any output
@@ -151,11 +160,24 @@ void QSynthiAudioProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuffer
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
     */
-    parameter->update(treeState, (float) getSampleRate());
+    parameter->update(treeState, synth->getEngineSampleRate(), governor.getQualityLevel());
     
     buffer.clear();
     
     synth->processBlock(buffer, midiMessages);
+    
+    // Switching the internal rate changes the resampler delay
+    if (synth->getLatencySamples() != getLatencySamples())
+        setLatencySamples(synth->getLatencySamples());
+    
+    governor.endBlock(buffer.getNumSamples());
+}
+
+void QSynthiAudioProcessor::parameterChanged(const String& parameterID, float newValue)
+{
+    // Can be called on any thread, the synth applies it at the start of its next block
+    if (parameterID == VOICE_COUNT)
+        synth->postVoiceCount(static_cast<int>(newValue));
 }
 
 //==============================================================================
@@ -194,7 +216,8 @@ void QSynthiAudioProcessor::setStateInformation (const void* data, int sizeInByt
     if (inputTree.isValid())
     {
         treeState.replaceState(inputTree);
-        parameter->update(treeState, (float) getSampleRate());
+        // Recomputed by the audio thread on its next update, the formulas are compiled here
+        parameter->loadFormulas();
     }
 }
 
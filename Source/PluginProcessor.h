@@ -11,12 +11,14 @@
 #include <JuceHeader.h>
 #include "QSynthi.hpp"
 #include "Parameter.h"
+#include "QualityGovernor.h"
 
 
 //==============================================================================
 /**
 */
-class QSynthiAudioProcessor  : public AudioProcessor
+class QSynthiAudioProcessor  : public AudioProcessor,
+                               private AudioProcessorValueTreeState::Listener
                             #if JucePlugin_Enable_ARA
                              , public AudioProcessorARAExtension
                             #endif
@@ -33,6 +35,9 @@ public:
     
     Parameter *parameter;
     QSynthi *synth;
+    
+    // Lowers simulation quality when processBlock runs out of CPU time
+    QualityGovernor governor;
 
     //==============================================================================
     QSynthiAudioProcessor();
@@ -73,6 +78,9 @@ public:
 
 private:
     
+    // Forwards structural parameter changes (voice count) to the synth
+    void parameterChanged(const String& parameterID, float newValue) override;
+    
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (QSynthiAudioProcessor)
 
@@ -10,7 +10,7 @@
 #include "Wavetable.hpp"
 
 
-QSynthi::QSynthi(Parameter *parameter) : parameter{ parameter }
+QSynthi::QSynthi(Parameter *parameter) : parameter{ parameter }, voices{ parameter }
 {
     
 
@@ -30,107 +30,258 @@ QSynthi::QSynthi(Parameter *parameter) : parameter{ parameter }
 }
 
 list<cfloat> QSynthi::getDisplayedWavetable() {
-    std::lock_guard lock(displayAccessMutex);
+    const auto& frame = displayFrames.read();
     
-    // Safety check: ensure displayedOscillator is valid and still playing
-    if (displayedOscillator != nullptr && displayedOscillator->isPlaying()) {
-        return displayedOscillator->waveTable;
+    // Only convert frames that were not seen yet
+    if (displayFrames.getReadVersion() != displayedVersion) {
+        displayedVersion = displayFrames.getReadVersion();
+        displayedWavetable = frame.valid
+            ? list<cfloat>(std::vector<cfloat>(frame.wavefunction.begin(), frame.wavefunction.end()))
+            : list<cfloat>();
     }
     
-    // If current displayed oscillator is invalid, try to find a valid one
-    if (displayedOscillator == nullptr || !displayedOscillator->isPlaying()) {
-        // Check if there's a valid oscillator in the queue
-        while (!displayQueue.empty()) {
-            auto nextOsc = displayQueue.front();
-            displayQueue.pop_front();
-            
-            if (nextOsc != nullptr && nextOsc->isPlaying()) {
-                displayedOscillator = nextOsc;
-                return displayedOscillator->waveTable;
-            }
-        }
-        
-        // No valid oscillators found, clear display
-        displayedOscillator = nullptr;
-    }
+    return displayedWavetable;
+}
+
+void QSynthi::setDisplayActive(const bool active) {
+    displayActive.store(active, std::memory_order_relaxed);
+}
+
+/**
+ Called by the audio thread after each block. Copies the displayed voice's wavefunction into the triple buffer,
+ so the editor never waits for the audio thread (and the other way round).
+ */
+void QSynthi::publishDisplayFrame() {
+    if (!displayActive.load(std::memory_order_relaxed))
+        return;
+    
+    // Displayed voice finished: continue with the next one that is still playing
+    while (displayedVoice >= 0 && !voices.isPlaying(displayedVoice))
+        displayedVoice = displayQueue.popFront();
+    
+    // Nothing to show: publish the empty frame once
+    if (displayedVoice < 0 && displayFrameEmpty)
+        return;
     
-    return list<cfloat>(); // Return empty list if no valid oscillator
+    auto& frame = displayFrames.getWriteBuffer();
+    frame.valid = displayedVoice >= 0;
+    if (frame.valid)
+        voices.copyWavefunction(displayedVoice, frame.wavefunction.data());
+    
+    displayFrames.publish();
+    displayFrameEmpty = !frame.valid;
 }
 
-bool QSynthi::hasDisplayedWavetable() const {
-    return displayedOscillator != nullptr;
+void QSynthi::addDisplayedVoice(const int voice) {
+    if (displayedVoice < 0) {
+        displayedVoice = voice;
+    } else if (voice != displayedVoice) {
+        // Only added if not already present
+        displayQueue.pushBack(voice);
+    }
+}
+
+void QSynthi::removeDisplayedVoice(const int voice) {
+    displayQueue.remove(voice);
+    
+    if (displayedVoice == voice) {
+        displayedVoice = displayQueue.popFront();
+    }
 }
 
 void QSynthi::prepareToPlay(const float sampleRate)
 {
     this->sampleRate = sampleRate;
     reverb.setSampleRate(sampleRate);
+    reverb.reset();
+    reverbIdle = true;
+    silentSamples = 0;
     
-    // Clear display system to prevent dangling pointers
-    {
-        std::lock_guard lock(displayAccessMutex);
-        displayedOscillator = nullptr;
-        displayQueue.clear();
+    // Prepared whenever the host is faster than the internal rate, so switching on the audio thread does not allocate
+    if (sampleRate > INTERNAL_SAMPLE_RATE) {
+        resampler.prepare(INTERNAL_SAMPLE_RATE, sampleRate, MAX_RESAMPLED_BLOCK);
+        engineBuffer.setSize(2, static_cast<int>(std::ceil(MAX_RESAMPLED_BLOCK * INTERNAL_SAMPLE_RATE / sampleRate)) + 2);
     }
     
-    playingOscillators = {};
-    sleepingOscillators = {};
+    resetEngine(parameter->internalRate && sampleRate > INTERNAL_SAMPLE_RATE);
+}
+
+/**
+ Starts the voices at the engine rate: the internal rate when resampling, else the host rate. Playing notes are cut.
+ */
+void QSynthi::resetEngine(const bool resample)
+{
+    resampling = resample;
+    engineSampleRate = resample ? INTERNAL_SAMPLE_RATE : sampleRate;
+    if (resample)
+        resampler.reset();
     
-    oscillators = mutable_list<WavetableOscillator>(static_cast<size_t>(parameter->numVoices), [this](size_t _){
-        return WavetableOscillator(parameter);
-    });
+    // Clear display system
+    displayedVoice = -1;
+    displayQueue.clear();
     
-    for (int i = 0; i < oscillators.length(); i++)
-    {
-        oscillators[i].prepareToPlay(sampleRate);
-        sleepingOscillators.append(&(oscillators[i]));
-    }
+    numVoices = std::min(static_cast<int>(parameter->numVoices), VoiceBank::MAX_VOICES);
+    voices.prepareToPlay(engineSampleRate);
+    allocator.reset(numVoices);
     
-    stolenNotes = {};
-    sustainedNotes = {};
+    stolenNotes.clear();
+    sustainedNotes.fill(false);
+}
+int QSynthi::getLatencySamples() const
+{
+    return resampling ? static_cast<int>(round(Resampler::TAPS / 2 * sampleRate / INTERNAL_SAMPLE_RATE)) : 0;
 }
+
 /**
  Coordinates handleMidiEvent(...) and render(...) to process the midiMessages and fill the buffer
  */
 void QSynthi::processBlock(AudioBuffer<float>& buffer, const MidiBuffer& midiMessages)
 {
-    // Test if number of oscillators changed
-    if (static_cast<size_t>(parameter->numVoices) != oscillators.length())
-    {
-        prepareToPlay(sampleRate);
-    }
+    processCommands();
     
+    // Switching the engine rate restarts the voices. The parameter factors follow with the next update
+    if (sampleRate > INTERNAL_SAMPLE_RATE && parameter->internalRate != resampling)
+        resetEngine(parameter->internalRate);
     
-    int currentSample = 0;
+    // Set by render() if any voice played in this block. Other MIDI traffic (clock, controllers) does not wake the reverb
+    voicesRendered = false;
     
-    reverb.setParameters(Reverb::Parameters{0.4f + 0.5f * parameter->reverbMix * parameter->reverbMix, 0.4f, 0.35f * parameter->reverbMix, (1-parameter->reverbMix), 0.8f, 0.0f});
+    reverb.setParameters(getReverbParameters(parameter->reverbMix));
+    allocator.setReleaseFactor(parameter->releaseFactor);
 
 
     // idea 1: create all, keep all always, ask everyone for isPlaying
     // idea 2: make list with playing oscis' references, maybe self-updating
     
     
+    if (resampling)
+        processResampled(buffer, midiMessages);
+    else
+        processEngine(buffer.getWritePointer(0), buffer.getWritePointer(1), buffer.getNumSamples(), midiMessages, 0, buffer.getNumSamples(), 1.0);
+    
+    publishDisplayFrame();
     
-    for (const auto midiMessage : midiMessages)
+    applyReverb(buffer, !voicesRendered);
+}
+
+void QSynthi::processEngine(float* left, float* right, const int numSamples, const MidiBuffer& midiMessages,
+                            const int midiStart, const int midiEnd, const double midiScale)
+{
+    int currentSample = 0;
+    
+    for (auto midiMessage = midiMessages.findNextSamplePosition(midiStart); midiMessage != midiMessages.cend(); ++midiMessage)
     {
-        const auto midiEvent = midiMessage.getMessage();
-        const auto midiEventSample = static_cast<int>(midiEvent.getTimeStamp());
+        const auto metadata = *midiMessage;
+        if (metadata.samplePosition >= midiEnd)
+            break;
+        
+        const int midiEventSample = std::clamp(static_cast<int>((metadata.samplePosition - midiStart) * midiScale), currentSample, numSamples);
         
         // Render everything before the event and handle it
-        render(buffer, currentSample, midiEventSample);
-        handleMidiEvent(midiEvent);
+        render(left, right, currentSample, midiEventSample);
+        handleMidiEvent(metadata.getMessage());
         
         currentSample = midiEventSample;
     }
     
-    // Render everything after the last midiEvent in this block
-    render(buffer, currentSample, buffer.getNumSamples());
+    // Render everything after the last midiEvent
+    render(left, right, currentSample, numSamples);
+}
+
+/**
+ Renders as many engine samples as each part of the host block needs and resamples them into it.
+ MIDI events keep their relative position within the part.
+ */
+void QSynthi::processResampled(AudioBuffer<float>& buffer, const MidiBuffer& midiMessages)
+{
+    float* engine[] = { engineBuffer.getWritePointer(0), engineBuffer.getWritePointer(1) };
     
-    // Apply Reverb
-    if (parameter->reverbMix != 0) {
-        reverb.processStereo(buffer.getWritePointer(0), buffer.getWritePointer(1), buffer.getNumSamples());
+    for (int hostStart = 0; hostStart < buffer.getNumSamples(); hostStart += MAX_RESAMPLED_BLOCK)
+    {
+        const int hostSamples = std::min(MAX_RESAMPLED_BLOCK, buffer.getNumSamples() - hostStart);
+        const int engineSamples = resampler.getNumInputSamples(hostSamples);
+        
+        engineBuffer.clear(0, engineSamples);
+        processEngine(engine[0], engine[1], engineSamples, midiMessages, hostStart, hostStart + hostSamples,
+                      static_cast<double>(engineSamples) / hostSamples);
+        
+        float* host[] = { buffer.getWritePointer(0, hostStart), buffer.getWritePointer(1, hostStart) };
+        resampler.process(engine, host, hostSamples);
     }
+}
+
+Reverb::Parameters QSynthi::getReverbParameters(const float reverbMix)
+{
+    return Reverb::Parameters{0.4f + 0.5f * reverbMix * reverbMix, 0.4f, 0.35f * reverbMix, (1-reverbMix), 0.8f, 0.0f};
+}
+
+void QSynthi::applyReverb(AudioBuffer<float>& buffer, const bool silentInput)
+{
+    if (!silentInput)
+        reverbIdle = false;
     
+    if (parameter->reverbMix == 0 || reverbIdle)
+        return;
+    
+    const int numSamples = buffer.getNumSamples();
+    reverb.processStereo(buffer.getWritePointer(0), buffer.getWritePointer(1), numSamples);
+    
+    // Without input, the buffer holds only the tail
+    if (!silentInput || buffer.getMagnitude(0, numSamples) >= SILENCE_LEVEL) {
+        silentSamples = 0;
+        return;
+    }
+    
+    silentSamples += numSamples;
+    if (silentSamples >= REVERB_SETTLE_TIME * sampleRate) {
+        reverb.reset();
+        reverbIdle = true;
+        silentSamples = 0;
+    }
+}
+
+/**
+ The voices sleep at 1% of RELEASE_THRESHOLD, which the release reaches after releaseTime.
+ Every round trip through the longest comb filter scales the reverb tail by its feedback (at most, damping only makes it
+ shorter), until it is below SILENCE_LEVEL and settled.
+ */
+double QSynthi::getTailLengthSeconds(const float releaseTime, const float reverbMix)
+{
+    const double release = releaseTime * std::log(Parameter::RELEASE_THRESHOLD * 0.01) / std::log(Parameter::RELEASE_THRESHOLD);
+    if (reverbMix == 0)
+        return release;
+    
+    const double feedback = getReverbParameters(reverbMix).roomSize * 0.28 + 0.7;
+    return release + REVERB_LONGEST_COMB * std::log(SILENCE_LEVEL) / std::log(feedback) + REVERB_SETTLE_TIME;
+}
+
+void QSynthi::postVoiceCount(const int count)
+{
+    pendingVoiceCount.store(count, std::memory_order_relaxed);
+}
+
+void QSynthi::processCommands()
+{
+    const int count = pendingVoiceCount.exchange(-1, std::memory_order_relaxed);
+    if (count >= 0)
+        setVoiceCount(count);
+}
+
+/**
+ All voices exist all the time, the count only limits how many the allocator hands out.
+ Voices above the new count are released and fade out normally.
+ */
+void QSynthi::setVoiceCount(int count)
+{
+    count = std::max(1, std::min(count, VoiceBank::MAX_VOICES));
+    if (count == numVoices)
+        return;
+    
+    numVoices = count;
+    allocator.setVoiceLimit(numVoices, [this](int voice) {
+        voices.noteOff(voice);
+        return voices.getLevel(voice);
+    });
 }
 
 void QSynthi::handleMidiEvent(const MidiMessage& midiEvent)
@@ -138,55 +289,27 @@ void QSynthi::handleMidiEvent(const MidiMessage& midiEvent)
     if (midiEvent.isNoteOn())
     {
         int noteNumber = midiEvent.getNoteNumber();
-        sustainedNotes.eraseItem(noteNumber);
+        sustainedNotes[noteNumber] = false;
+        // Pressed again: it gets a voice now, not on a later note-off
+        stolenNotes.remove(noteNumber);
         
-        WavetableOscillator* oscillator = nullptr;
+        // Playing voice with same note?
+        int voice = allocator.getHeldVoice(noteNumber);
         
-        // Find playing Osci with same note
-        for (size_t i = 0; i < playingOscillators.length(); i++)
-        {
-            if (playingOscillators[i]->midiNote == noteNumber)
-            {
-                oscillator = playingOscillators[i];
-                playingOscillators.erase(i);
-                break;
-            }
-        }
-        // No playing Osci found
-        if (oscillator == nullptr)
+        // No playing voice found: free or quietest releasing voice, else steal the oldest held one
+        if (voice < 0)
         {
-            if (sleepingOscillators.length() > 0) {
-                oscillator = sleepingOscillators[0];
-                sleepingOscillators.erase(0);
-            } else {
-                oscillator = playingOscillators[0];
-                playingOscillators.erase(0);
-                stolenNotes.append(oscillator->midiNote);
+            voice = allocator.acquire();
+            if (voice < 0) {
+                voice = allocator.getOldestHeldVoice();
+                stolenNotes.push(voices.getMidiNote(voice));
             }
         }
         
-        playingOscillators.append(oscillator);
-        oscillator->noteOn(noteNumber, midiEvent.getVelocity());
+        allocator.hold(voice, noteNumber, [this](int displaced) { return releaseDisplacedVoice(displaced); });
+        voices.noteOn(voice, noteNumber, midiEvent.getVelocity());
         
-        // Update display system
-        {
-            std::lock_guard lock(displayAccessMutex);
-            if (displayedOscillator == nullptr) {
-                displayedOscillator = oscillator;
-            } else {
-                // Only add to queue if not already present
-                bool alreadyInQueue = false;
-                for (auto& queuedOsc : displayQueue) {
-                    if (queuedOsc == oscillator) {
-                        alreadyInQueue = true;
-                        break;
-                    }
-                }
-                if (!alreadyInQueue) {
-                    displayQueue.push_back(oscillator);
-                }
-            }
-        }
+        addDisplayedVoice(voice);
     }
     else if (midiEvent.isNoteOff())
     {
@@ -194,7 +317,7 @@ void QSynthi::handleMidiEvent(const MidiMessage& midiEvent)
         
         if (sustain)
         {
-            sustainedNotes.append(noteNumber);
+            sustainedNotes[noteNumber] = true;
         }
         else
         {
@@ -205,22 +328,28 @@ void QSynthi::handleMidiEvent(const MidiMessage& midiEvent)
     }
     else if (midiEvent.isAllNotesOff())
     {
-        for (size_t i = 0; i < playingOscillators.length(); i++) {
-            playingOscillators[i]->noteOff();
-            this->sleepingOscillators.append(playingOscillators[i]);
-        }
+        allocator.releaseAll([this](int voice) {
+            voices.noteOff(voice);
+            return voices.getLevel(voice);
+        });
 
         // Clear display system
-        {
-            std::lock_guard lock(displayAccessMutex);
-            displayedOscillator = nullptr;
-            displayQueue.clear();
-        }
+        displayedVoice = -1;
+        displayQueue.clear();
         
-        playingOscillators = {};
-        stolenNotes = {};
+        stolenNotes.clear();
         
     }
+    else if (midiEvent.isAftertouch())
+    {
+        const int voice = allocator.getHeldVoice(midiEvent.getNoteNumber());
+        if (voice >= 0)
+            voices.setPressure(voice, midiEvent.getAfterTouchValue() / 127.f);
+    }
+    else if (midiEvent.isChannelPressure())
+    {
+        voices.setChannelPressure(midiEvent.getChannelPressureValue() / 127.f);
+    }
     else if (midiEvent.isSustainPedalOn())
     {
         sustain = true;
@@ -228,119 +357,59 @@ void QSynthi::handleMidiEvent(const MidiMessage& midiEvent)
     else if (midiEvent.isSustainPedalOff())
     {
         sustain = false;
-        for (int i = 0; i < sustainedNotes.length(); i++) {
-            noteOff(sustainedNotes[i]);
+        for (int note = 0; note < VoiceAllocator::NUM_NOTES; note++) {
+            if (sustainedNotes[note])
+                noteOff(note);
         }
-        sustainedNotes = {};
+        sustainedNotes.fill(false);
     }
 }
 
-void QSynthi::setDisplayedOscillator(WavetableOscillator *o) {
-    std::lock_guard lock(displayAccessMutex);
+void QSynthi::noteOff(int noteNumber) {
+    stolenNotes.remove(noteNumber);
+    
+    const int voice = allocator.getHeldVoice(noteNumber);
+    if (voice < 0)
+        return;
     
-    // Safety check: only set valid oscillators that are playing
-    if (o == nullptr || o->isPlaying()) {
-        displayedOscillator = o;
+    if (stolenNotes.isEmpty()) {
+        voices.noteOff(voice);
+        allocator.release(voice, voices.getLevel(voice));
+        
+        removeDisplayedVoice(voice);
+        
     } else {
-        displayedOscillator = nullptr;
+        // Voice stealing - reuse this voice for a stolen note
+        int midiNote = stolenNotes.getTop();
+        stolenNotes.remove(midiNote);
+        
+        // Remove from display queue before reusing, add back with the new note
+        displayQueue.remove(voice);
+        
+        allocator.hold(voice, midiNote, [this](int displaced) { return releaseDisplacedVoice(displaced); });
+        voices.noteOn(voice, midiNote, 127);
+        
+        addDisplayedVoice(voice);
     }
 }
 
-void QSynthi::noteOff(int noteNumber) {
-    stolenNotes.eraseItem(noteNumber);
-    
-    for (int i = 0; i < playingOscillators.length(); i++) {
-        if (playingOscillators[i]->midiNote == noteNumber)
-        {
-            auto o = playingOscillators[i];
-            
-            if (stolenNotes.length() <= 0) {
-                o->noteOff();
-                sleepingOscillators.append(o);
-                
-                // Remove from display queue
-                {
-                    std::lock_guard lock(displayAccessMutex);
-                    for (auto it = displayQueue.begin(); it != displayQueue.end(); ++it) {
-                        if (*it == o) {
-                            displayQueue.erase(it);
-                            break;
-                        }
-                    }
-                    
-                    // Update displayed oscillator if needed
-                    if (displayedOscillator == o) {
-                        displayedOscillator = nullptr;
-                        if (!displayQueue.empty()) {
-                            displayedOscillator = displayQueue.front();
-                            displayQueue.pop_front();
-                        }
-                    }
-                }
-                
-                playingOscillators.erase(i--);
-                
-            } else {
-                // Voice stealing - reuse this oscillator for a stolen note
-                int midiNote = stolenNotes[stolenNotes.length() - 1];
-                stolenNotes.eraseItem(midiNote);
-                
-                // Remove from display queue before reusing
-                {
-                    std::lock_guard lock(displayAccessMutex);
-                    for (auto it = displayQueue.begin(); it != displayQueue.end(); ++it) {
-                        if (*it == o) {
-                            displayQueue.erase(it);
-                            break;
-                        }
-                    }
-                }
-                
-                playingOscillators.erase(i--);
-                playingOscillators.append(o);
-                o->noteOn(midiNote, 127);
-                
-                // Add back to display queue with new note
-                {
-                    std::lock_guard lock(displayAccessMutex);
-                    if (displayedOscillator == nullptr) {
-                        displayedOscillator = o;
-                    } else {
-                        displayQueue.push_back(o);
-                    }
-                }
-            }
-        }
-    }
+float QSynthi::releaseDisplacedVoice(const int voice)
+{
+    voices.noteOff(voice);
+    removeDisplayedVoice(voice);
+    return voices.getLevel(voice);
 }
 
-
-void QSynthi::render(AudioBuffer<float>& buffer, int startSample, int endSample)
+void QSynthi::render(float* left, float* right, int startSample, int endSample)
 {
-    auto* left = buffer.getWritePointer(0);
-    auto* right = buffer.getWritePointer(1);
-    
-    oscillators
-        //.filter([](auto oscillator) { return oscillator.isPlaying(); })
-        .forEach([startSample, endSample, left, right, this](auto& oscillator) {
-            // skip sleeping oscis
-            if (!oscillator.isPlaying())
-                return;
-            // 
-            for (int sample = startSample; sample < endSample; ++sample)
-            {
-                float phase = oscillator.getPhase();
-                float sampleData = oscillator.getNextSample();
-                
-                // Apply stereoize
-                left[sample] += sampleData * parameter->stereoList[phase];
-                right[sample] += sampleData * parameter->stereoList[Wavetable::SIZE - 1 - phase];
-            }
-        });
-    
-    // Apply Gian
-    for (int sample = startSample; sample < endSample; ++sample) {
-        left[sample] *= parameter->gainFactor;
-        right[sample] *= parameter->gainFactor;
+    for (int blockStart = startSample; blockStart < endSample; blockStart += VoiceBank::RENDER_BLOCK_SIZE)
+    {
+        const int numSamples = std::min(VoiceBank::RENDER_BLOCK_SIZE, endSample - blockStart);
+        voicesRendered = voicesRendered || voices.getNumActiveVoices() > 0;
+        voices.render(left + blockStart, right + blockStart, numSamples);
+        
+        allocator.advanceReleaseClock(numSamples);
+        for (int i = 0; i < voices.getNumFinishedVoices(); i++)
+            allocator.finished(voices.getFinishedVoice(i));
     }
 }
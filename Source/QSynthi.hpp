@@ -11,9 +11,12 @@
 #include <stdio.h>
 #include <vector>
 #include "list.hpp"
-#include "WavetableOscillator.hpp"
+#include "VoiceBank.hpp"
+#include "VoiceAllocator.hpp"
 #include "Parameter.h"
 #include "WavetablePlot.h"
+#include "TripleBuffer.h"
+#include "Resampler.hpp"
 
 
 
@@ -23,42 +26,102 @@ public:
     QSynthi(Parameter *parameter);
     QSynthi() {}
 
+    // Editor side: the latest frame published by the audio thread, empty if no voice is displayed
     list<cfloat> getDisplayedWavetable();
-    bool hasDisplayedWavetable() const;
+    // Frames are only published while the display is active (an editor is open)
+    void setDisplayActive(bool active);
 
     void prepareToPlay(float sampleRate);
     void processBlock(AudioBuffer<float>& buffer, const MidiBuffer& midiMessages);
+
+    /** With Parameter::internalRate, the voices run at this rate on faster hosts and their mix is resampled to the host
+     rate (Resampler), so their cost does not grow with the session's rate. The reverb runs at the host rate */
+    static constexpr float INTERNAL_SAMPLE_RATE = 48000.f;
+    // Voices that are playing or releasing. Audio thread
+    inline int getNumActiveVoices() const { return voices.getNumActiveVoices(); }
+    // Rate of the voices, for the parameter update. Audio thread
+    inline float getEngineSampleRate() const { return engineSampleRate; }
+    // Delay of the resampler at the host rate (TAPS / 2 engine samples), 0 without resampling. Audio thread or prepareToPlay
+    int getLatencySamples() const;
+
+    /** Structural change, applied by the audio thread at the start of the next block. Can be called from any thread
+     (host automation also calls from the audio thread), only the latest count is kept */
+    void postVoiceCount(int count);
+
+    // Output level that counts as silence (-100 dB)
+    static constexpr float SILENCE_LEVEL = 0.00001f;
+    // Time until the output is silent after the last note-off, for the host
+    static double getTailLengthSeconds(float releaseTime, float reverbMix);
     
 private:
     bool sustain = false;
     
     Parameter *parameter;
     float sampleRate;
+    float engineSampleRate = 44100.f;
+
+    // Fixed engine rate: the host block is rendered in parts of at most MAX_RESAMPLED_BLOCK samples
+    static constexpr int MAX_RESAMPLED_BLOCK = 512;
+    bool resampling = false;
+    Resampler resampler;
+    AudioBuffer<float> engineBuffer;
+    void resetEngine(bool resample);
+    void processResampled(AudioBuffer<float>& buffer, const MidiBuffer& midiMessages);
 
     
-    /** Map for all playing oscillators
-        noteNumber -> playing Oscillator on this note
-     life-cycle of an Oscillator:
-        noteOnEvent in handleMidiEvent(...): gets created and inserted in map
-        noteOffEvent in handleMidiEvent(...): triggers the release state
-        getSample(...): releases the sound
-        processBlock(...) cleanup: checks for every oscillator if it thinks it's done with it's life cycle and removes if it's the case
+    /** All voices, referenced by their index
+     life-cycle of a voice:
+        noteOnEvent in handleMidiEvent(...): taken from the allocator (free, quietest releasing or stolen) and held
+        noteOffEvent in handleMidiEvent(...): triggers the release state, the allocator ranks it for reuse
+        render(...): releases the sound, finished voices become free again
      */
-    mutable_list<WavetableOscillator> oscillators;
-    mutable_list<WavetableOscillator*> playingOscillators;
-    mutable_list<WavetableOscillator*> sleepingOscillators;
+    VoiceBank voices;
+    VoiceAllocator allocator;
+    int numVoices = 0;
+
+    // Display: voice tracking belongs to the audio thread, the editor only reads published frames
+    struct DisplayFrame
+    {
+        bool valid = false;
+        std::array<cfloat, Wavetable::SIZE> wavefunction;
+    };
+    int displayedVoice = -1;
+    VoiceQueue displayQueue;
+    TripleBuffer<DisplayFrame> displayFrames;
+    std::atomic<bool> displayActive{ false };
+    bool displayFrameEmpty = true;          // last published frame had no voice
+    void addDisplayedVoice(int voice);
+    void removeDisplayedVoice(int voice);
+    void publishDisplayFrame();
 
-    WavetableOscillator* displayedOscillator = nullptr;
-    std::deque<WavetableOscillator*> displayQueue;
-    std::mutex displayAccessMutex;
-    void setDisplayedOscillator(WavetableOscillator* o);
+    // Editor side cache of the last read frame
+    list<cfloat> displayedWavetable;
+    uint64 displayedVersion = 0;
 
-    mutable_list<int> stolenNotes;
-    mutable_list<int> sustainedNotes;
+    NoteStack stolenNotes;                  // held notes whose voice was taken, get a voice back on the next note-off
+    std::array<bool, VoiceAllocator::NUM_NOTES> sustainedNotes{};
 
+    /** The reverb only runs while it has something to do: after the voices stopped, its output has to stay below
+     SILENCE_LEVEL for REVERB_SETTLE_TIME (longer than its delay lines), then it is cleared and skipped until the next note */
     Reverb reverb;
+    static constexpr float REVERB_SETTLE_TIME = 0.05f;
+    static constexpr float REVERB_LONGEST_COMB = 0.0372f;   // longest comb filter delay of Reverb (1640 samples at 44.1 kHz)
+    bool reverbIdle = true;
+    int silentSamples = 0;
+    bool voicesRendered = false;            // any voice was active in the current block
+    static Reverb::Parameters getReverbParameters(float reverbMix);
+    void applyReverb(AudioBuffer<float>& buffer, bool silentInput);
+
+    std::atomic<int> pendingVoiceCount{ -1 };      // -1 if nothing is pending
+    void processCommands();
+    void setVoiceCount(int count);
 
     void noteOff(int noteNumber);
+    // Key up for a voice whose note was taken over by another voice, returns its level for the allocator
+    float releaseDisplacedVoice(int voice);
     void handleMidiEvent(const MidiMessage& midiEvent);
-    void render(AudioBuffer<float>& buffer, int startSample, int endSample);
+    // Renders numSamples at the engine rate, with the events of midiMessages in [midiStart, midiEnd) moved to
+    // (position - midiStart) * midiScale
+    void processEngine(float* left, float* right, int numSamples, const MidiBuffer& midiMessages, int midiStart, int midiEnd, double midiScale);
+    void render(float* left, float* right, int startSample, int endSample);
 };
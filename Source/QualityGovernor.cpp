@@ -0,0 +1,69 @@
+/*
+  ==============================================================================
+
+    QualityGovernor.cpp
+    Created: 19 Oct 2026 9:12:40am
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#include "QualityGovernor.h"
+
+void QualityGovernor::prepareToPlay(const float sampleRate)
+{
+    this->sampleRate = sampleRate;
+    smoothedLoad = 0;
+    settleBlocks = 0;
+    headroomTime = 0;
+    qualityLevel = 0;
+    load = 0;
+}
+
+void QualityGovernor::beginBlock()
+{
+    blockStartTicks = Time::getHighResolutionTicks();
+}
+
+void QualityGovernor::endBlock(const int numSamples)
+{
+    if (numSamples <= 0)
+        return;
+
+    const double elapsed = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - blockStartTicks);
+    const double deadline = numSamples / sampleRate;
+    const float blockLoad = static_cast<float>(elapsed / deadline);
+
+    // React fast to overload, slowly to headroom
+    smoothedLoad += (blockLoad > smoothedLoad ? 0.5f : 0.05f) * (blockLoad - smoothedLoad);
+    load = smoothedLoad;
+
+    int level = qualityLevel.load(std::memory_order_relaxed);
+
+    if (settleBlocks > 0)
+        settleBlocks--;
+
+    if (smoothedLoad > DEGRADE_LOAD || blockLoad > 1.f)
+    {
+        headroomTime = 0;
+        if (settleBlocks == 0 && level < MAX_LEVEL)
+        {
+            qualityLevel = ++level;
+            settleBlocks = SETTLE_BLOCKS;
+        }
+    }
+    else if (smoothedLoad < RESTORE_LOAD && level > 0)
+    {
+        headroomTime += numSamples / sampleRate;
+        if (headroomTime >= RESTORE_TIME)
+        {
+            qualityLevel = --level;
+            settleBlocks = SETTLE_BLOCKS;
+            headroomTime = 0;
+        }
+    }
+    else
+    {
+        headroomTime = 0;
+    }
+}
@@ -0,0 +1,57 @@
+/*
+  ==============================================================================
+
+    QualityGovernor.h
+    Created: 19 Oct 2026 9:12:40am
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+
+/**
+ Measures every processBlock against its deadline (block length / sample rate) and lowers the simulation quality
+ step by step when the CPU budget runs short. Quality is restored once there is enough headroom again.
+
+ Quality levels:
+    0: full quality
+    1: half timestep rate (doubled timestep delta, same simulated speed)
+    2: quarter timestep rate
+    3: quarter timestep rate + quiet voices stop simulating
+ */
+class QualityGovernor
+{
+public:
+    static constexpr int MAX_LEVEL = 3;
+
+    // Load = processing time / block deadline
+    static constexpr float DEGRADE_LOAD = 0.75f;
+    static constexpr float RESTORE_LOAD = 0.35f;
+    // Seconds of headroom needed before one level gets restored
+    static constexpr float RESTORE_TIME = 1.f;
+    // Blocks to wait after a change before degrading further (the new level needs time to show its effect)
+    static constexpr int SETTLE_BLOCKS = 4;
+
+    void prepareToPlay(float sampleRate);
+
+    void beginBlock();
+    void endBlock(int numSamples);
+
+    // Can be called from any thread (e.g. by the editor)
+    inline int getQualityLevel() const { return qualityLevel.load(std::memory_order_relaxed); }
+    inline float getLoad() const { return load.load(std::memory_order_relaxed); }
+
+private:
+    float sampleRate = 44100.f;
+
+    int64 blockStartTicks = 0;
+    float smoothedLoad = 0;
+    int settleBlocks = 0;
+    float headroomTime = 0;
+
+    std::atomic<int> qualityLevel{ 0 };
+    std::atomic<float> load{ 0 };
+};
@@ -0,0 +1,129 @@
+//
+//  Resampler.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#include "Resampler.hpp"
+#include <cmath>
+
+static bool isSilent(const float* samples, const int numSamples)
+{
+    for (int i = 0; i < numSamples; i++)
+        if (samples[i] != 0)
+            return false;
+    return true;
+}
+
+// TAPS products, summed in lanes so the loop vectorizes
+static inline float dot(const float* samples, const float* coefficients)
+{
+    constexpr int LANES = 8;
+    static_assert(Resampler::TAPS % LANES == 0);
+
+    alignas(32) float sum[LANES] = {};
+    for (int k = 0; k < Resampler::TAPS; k += LANES)
+        for (int lane = 0; lane < LANES; lane++)
+            sum[lane] += samples[k + lane] * coefficients[k + lane];
+
+    float result = 0;
+    for (int lane = 0; lane < LANES; lane++)
+        result += sum[lane];
+    return result;
+}
+
+void Resampler::prepare(const double inputRate, const double outputRate, const int maxOutputSamples)
+{
+    jassert(inputRate <= outputRate);
+    step = inputRate / outputRate;
+
+    // Tap k of phase p weights the input sample at distance d = k + 1 - TAPS / 2 - p / PHASES from the output time
+    const double pi = MathConstants<double>::pi;
+    const double halfWidth = TAPS / 2;
+    kernel.resize((PHASES + 1) * TAPS);
+    for (int p = 0; p <= PHASES; p++)
+    {
+        float* coefficients = kernel.data() + p * TAPS;
+        double sum = 0;
+        for (int k = 0; k < TAPS; k++)
+        {
+            const double d = k + 1 - halfWidth - static_cast<double>(p) / PHASES;
+            const double x = pi * CUTOFF * d;
+            const double sinc = x == 0 ? 1 : std::sin(x) / x;
+            const double window = 0.42 + 0.5 * std::cos(pi * d / halfWidth) + 0.08 * std::cos(2 * pi * d / halfWidth);
+            coefficients[k] = static_cast<float>(sinc * window);
+            sum += coefficients[k];
+        }
+        // Every phase passes DC unchanged
+        for (int k = 0; k < TAPS; k++)
+            coefficients[k] = static_cast<float>(coefficients[k] / sum);
+    }
+
+    for (auto& channel : history)
+        channel.resize(TAPS + static_cast<size_t>(std::ceil(maxOutputSamples * step)) + 2);
+    reset();
+}
+
+void Resampler::reset()
+{
+    for (auto& channel : history)
+        std::fill(channel.begin(), channel.end(), 0.f);
+    position = 0;
+    silent = true;
+}
+
+int Resampler::getNumInputSamples(const int numOutputSamples) const
+{
+    // The last output reads up to the input sample at floor(its position)
+    return static_cast<int>(position + (numOutputSamples - 1) * step + 1);
+}
+
+void Resampler::process(const float* const* input, float* const* output, const int numOutputSamples)
+{
+    const int numInput = getNumInputSamples(numOutputSamples);
+    jassert(TAPS + numInput <= static_cast<int>(history[0].size()));
+
+    bool inputSilent = true;
+    for (int channel = 0; channel < NUM_CHANNELS; channel++)
+        inputSilent = inputSilent && isSilent(input[channel], numInput);
+
+    if (silent && inputSilent)
+    {
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+            FloatVectorOperations::clear(output[channel], numOutputSamples);
+    }
+    else
+    {
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+        {
+            float* x = history[channel].data();
+            std::copy(input[channel], input[channel] + numInput, x + TAPS);
+
+            for (int n = 0; n < numOutputSamples; n++)
+            {
+                // time > -1, so the cast rounds down (std::floor can be a library call)
+                const double time = position + n * step;
+                const int whole = static_cast<int>(time + 1) - 1;
+                const float phase = static_cast<float>(time - whole) * PHASES;
+                const int p = std::min(static_cast<int>(phase), PHASES - 1);
+                const float fraction = phase - static_cast<float>(p);
+
+                // Between the two nearest phases. Integer ratios (96 and 192 kHz) only hit exact phases
+                const float* samples = x + whole + 1;
+                const float* lower = kernel.data() + p * TAPS;
+                const float a = dot(samples, lower);
+                output[channel][n] = fraction == 0 ? a : a + fraction * (dot(samples, lower + TAPS) - a);
+            }
+
+            // The newest TAPS samples are the history of the next call
+            std::copy(x + numInput, x + numInput + TAPS, x);
+        }
+
+        silent = true;
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+            silent = silent && isSilent(history[channel].data(), TAPS);
+    }
+
+    position += numOutputSamples * step - numInput;
+}
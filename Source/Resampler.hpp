@@ -0,0 +1,53 @@
+//
+//  Resampler.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include "JuceHeader.h"
+#include <array>
+#include <vector>
+
+/**
+ Stereo polyphase FIR resampler from a lower input rate to the output rate (the fixed engine rate to the host rate).
+
+ The kernel is a Blackman windowed sinc with TAPS taps and its cutoff at CUTOFF times the input Nyquist frequency (flat to
+ about 20 kHz and closed at 24 kHz for a 48 kHz input). It is stored for PHASES + 1 fractional positions, and an output
+ sample interpolates linearly between the two nearest phases. Any ratio works, integer ratios hit the phases exactly.
+ The output is delayed by TAPS / 2 input samples.
+
+ prepare() allocates, process() does not. It also skips the filter while input and history are silent.
+ */
+class Resampler
+{
+public:
+    static constexpr int TAPS = 64;
+    static constexpr int PHASES = 256;
+
+    // Message thread (or prepareToPlay): builds the kernel and the history for blocks of up to maxOutputSamples
+    void prepare(double inputRate, double outputRate, int maxOutputSamples);
+    // Clears the history, the next output starts at the first new input sample
+    void reset();
+
+    // Number of new input samples that the next numOutputSamples (at most maxOutputSamples) outputs consume
+    int getNumInputSamples(int numOutputSamples) const;
+
+    // Consumes getNumInputSamples(numOutputSamples) samples of input and writes numOutputSamples samples to output
+    void process(const float* const* input, float* const* output, int numOutputSamples);
+
+private:
+    static constexpr int NUM_CHANNELS = 2;
+    static constexpr double CUTOFF = 0.92;
+
+    double step = 1;            // input samples per output sample
+    double position = 0;        // of the next output in input samples, relative to the first new one (-1 < position < 1)
+    bool silent = true;         // history is all zero
+
+    // (PHASES + 1) * TAPS coefficients, phase by phase
+    std::vector<float> kernel;
+    // TAPS samples of history, then the new input
+    std::array<std::vector<float>, NUM_CHANNELS> history;
+};
@@ -0,0 +1,23 @@
+//
+//  StateVariableFilter.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#include "StateVariableFilter.hpp"
+#include "JuceHeader.h"
+#include <cmath>
+
+static std::array<float, StateVariableFilter::TAN_TABLE_SIZE + 2> makeTanTable()
+{
+    std::array<float, StateVariableFilter::TAN_TABLE_SIZE + 2> table;
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        const double ratio = std::min(i, (size_t)StateVariableFilter::TAN_TABLE_SIZE) * (double)StateVariableFilter::MAX_CUTOFF_RATIO / StateVariableFilter::TAN_TABLE_SIZE;
+        table[i] = static_cast<float>(std::tan(MathConstants<double>::pi * ratio));
+    }
+    return table;
+}
+
+const std::array<float, StateVariableFilter::TAN_TABLE_SIZE + 2> StateVariableFilter::tanTable = makeTanTable();
@@ -0,0 +1,67 @@
+//
+//  StateVariableFilter.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include <array>
+#include <algorithm>
+
+/**
+ Zero-delay-feedback (topology-preserving transform) state variable filter, low pass output.
+ The cutoff can change every sample: the prewarped gain tan(pi * cutoff / sampleRate) comes from a table,
+ so a sample costs a table lookup, one reciprocal and a handful of multiply-adds.
+
+ The filter state is owned by the caller (two integrator states per voice).
+ */
+class StateVariableFilter
+{
+public:
+    // Highest cutoff relative to the sample rate; tan() gets steep towards Nyquist
+    constexpr static float MAX_CUTOFF_RATIO = 0.49f;
+    constexpr static int TAN_TABLE_SIZE = 1024;
+
+    // g = tan(pi * cutoff / sampleRate), cutoffRatio = cutoff / sampleRate
+    static inline float cutoffToGain(float cutoffRatio)
+    {
+        const float x = std::max(std::min(cutoffRatio, MAX_CUTOFF_RATIO), 0.f) * TABLE_SCALE;
+        const int index = static_cast<int>(x);
+        const float fraction = x - static_cast<float>(index);
+        return tanTable[index] + (tanTable[index + 1] - tanTable[index]) * fraction;
+    }
+
+    // k = 1 / Q
+    static inline float processLowPass(const float in, const float g, const float k, float& ic1eq, float& ic2eq)
+    {
+        const float a1 = 1.f / (1.f + g * (g + k));
+        const float a2 = g * a1;
+        const float a3 = g * a2;
+
+        const float v3 = in - ic2eq;
+        const float v1 = a1 * ic1eq + a2 * v3;
+        const float v2 = ic2eq + a2 * ic1eq + a3 * v3;
+        ic1eq = 2.f * v1 - ic1eq;
+        ic2eq = 2.f * v2 - ic2eq;
+        return v2;
+    }
+
+    // Lanes independent filters at once (e.g. one per voice), each with its own gain and state.
+    // Same arithmetic as the single filter above, laid out so the compiler can use vector registers.
+    template <int Lanes>
+    static inline void processLowPass(float* inOut, const float* g, const float k, float* ic1eq, float* ic2eq)
+    {
+        for (int lane = 0; lane < Lanes; lane++)
+        {
+            inOut[lane] = processLowPass(inOut[lane], g[lane], k, ic1eq[lane], ic2eq[lane]);
+        }
+    }
+
+private:
+    constexpr static float TABLE_SCALE = TAN_TABLE_SIZE / MAX_CUTOFF_RATIO;
+
+    // TAN_TABLE_SIZE + 1 points from 0 to MAX_CUTOFF_RATIO, one extra to interpolate at the upper end
+    static const std::array<float, TAN_TABLE_SIZE + 2> tanTable;
+};
@@ -0,0 +1,60 @@
+/*
+  ==============================================================================
+
+    TripleBuffer.h
+    Created: 19 Oct 2026 2:05:18pm
+    Author:  Arthur
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+
+/**
+ Wait-free single writer / single reader exchange of the latest value.
+
+ Three slots: the writer fills its back slot and swaps it with the middle one on publish(),
+ the reader swaps its front slot with the middle one when something new was published.
+ Neither side ever waits for the other or sees a slot that is being written.
+ Every publish gets a version number, so the reader can tell whether its value changed.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer --------------------------------------------------------------------------------------------
+    inline T& getWriteBuffer() { return slots[backIndex]; }
+
+    inline void publish()
+    {
+        versions[backIndex] = ++writeVersion;
+        backIndex = state.exchange(backIndex | NEW_DATA, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Reader --------------------------------------------------------------------------------------------
+    // The latest published value, stays valid until the next read()
+    inline const T& read()
+    {
+        if (state.load(std::memory_order_relaxed) & NEW_DATA)
+            frontIndex = state.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return slots[frontIndex];
+    }
+
+    // Version of the value returned by the last read(), 0 if nothing was published yet
+    inline uint64 getReadVersion() const { return versions[frontIndex]; }
+
+private:
+    static constexpr int INDEX_MASK = 3;
+    static constexpr int NEW_DATA = 4;
+
+    std::array<T, 3> slots{};
+    std::array<uint64, 3> versions{};
+
+    int backIndex = 0;                      // writer only
+    int frontIndex = 1;                     // reader only
+    std::atomic<int> state{ 2 };            // middle index + NEW_DATA flag
+    uint64 writeVersion = 0;                // writer only
+};
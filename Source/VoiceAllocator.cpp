@@ -0,0 +1,307 @@
+//
+//  VoiceAllocator.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#include "VoiceAllocator.hpp"
+#include <cmath>
+
+void VoiceAllocator::reset(const int numVoices)
+{
+    noteToVoice.fill(-1);
+    voiceNote.fill(-1);
+    pool.fill(NONE);
+    freeHead = -1;
+    heldHead = heldTail = -1;
+    heapSize = 0;
+    releaseClock = 0;
+
+    voiceLimit = 0;
+    applyVoiceLimit(numVoices);
+}
+
+void VoiceAllocator::applyVoiceLimit(const int numVoices)
+{
+    voiceLimit = numVoices;
+
+    for (int voice = 0; voice < MAX_VOICES; voice++)
+    {
+        const bool allowed = voice < voiceLimit;
+
+        if (!allowed && pool[voice] == RELEASING)
+        {
+            heapRemove(voice);
+            pool[voice] = RETIRED;
+        }
+        else if (allowed && pool[voice] == RETIRED)
+        {
+            // releaseKey is still valid
+            heapPush(voice);
+        }
+    }
+
+    // Rebuild the free stack, in reverse so the lowest voice is taken first
+    freeHead = -1;
+    for (int voice = MAX_VOICES - 1; voice >= 0; voice--)
+    {
+        if (voice < voiceLimit && (pool[voice] == FREE || pool[voice] == NONE))
+            pushFree(voice);
+        else if (pool[voice] == FREE)
+            pool[voice] = NONE;
+    }
+}
+
+void VoiceAllocator::setReleaseFactor(const float releaseFactor)
+{
+    const double newLogReleaseFactor = std::log(std::max(static_cast<double>(releaseFactor), 1e-30));
+    if (newLogReleaseFactor == logReleaseFactor)
+        return;
+
+    // The current log level key + clock * log(factor) stays the same for every voice
+    shiftReleaseKeys(releaseClock * (logReleaseFactor - newLogReleaseFactor));
+    logReleaseFactor = newLogReleaseFactor;
+}
+
+void VoiceAllocator::advanceReleaseClock(const int numSamples)
+{
+    releaseClock += numSamples;
+
+    if (releaseClock >= MAX_RELEASE_CLOCK)
+    {
+        shiftReleaseKeys(releaseClock * logReleaseFactor);
+        releaseClock = 0;
+    }
+}
+
+void VoiceAllocator::shiftReleaseKeys(const double amount)
+{
+    for (int voice = 0; voice < MAX_VOICES; voice++)
+    {
+        if (pool[voice] == RELEASING || pool[voice] == RETIRED)
+            releaseKey[voice] += amount;
+    }
+}
+
+int VoiceAllocator::acquire()
+{
+    if (freeHead >= 0)
+        return freeHead;
+    if (heapSize > 0)
+        return heap[0];
+    return -1;
+}
+
+void VoiceAllocator::assign(const int voice, const int note)
+{
+    remove(voice);
+
+    // A note is held by one voice at most, hold() released any other one
+    jassert(noteToVoice[note] < 0);
+    voiceNote[voice] = note;
+    noteToVoice[note] = voice;
+    appendHeld(voice);
+}
+
+void VoiceAllocator::release(const int voice, const float level)
+{
+    remove(voice);
+
+    // log level now, extrapolated back to clock 0: log(level) - clock * log(releaseFactor)
+    releaseKey[voice] = std::log(std::max(static_cast<double>(level), 1e-30)) - releaseClock * logReleaseFactor;
+    heapPush(voice);
+}
+
+void VoiceAllocator::finished(const int voice)
+{
+    if (pool[voice] == RELEASING)
+    {
+        remove(voice);
+        pushFree(voice);
+    }
+    else if (pool[voice] == RETIRED)
+    {
+        pool[voice] = NONE;
+    }
+}
+
+
+// Pools --------------------------------------------------------------------------------------------------------------------------
+//
+
+void VoiceAllocator::remove(const int voice)
+{
+    switch (pool[voice]) {
+        case NONE:
+        case RETIRED:
+            break;
+
+        case FREE:
+            // Only the top is ever taken
+            jassert(freeHead == voice);
+            freeHead = next[voice];
+            break;
+
+        case HELD:
+            removeHeld(voice);
+            noteToVoice[voiceNote[voice]] = -1;
+            voiceNote[voice] = -1;
+            break;
+
+        case RELEASING:
+            heapRemove(voice);
+            break;
+    }
+    pool[voice] = NONE;
+}
+
+void VoiceAllocator::pushFree(const int voice)
+{
+    next[voice] = freeHead;
+    freeHead = voice;
+    pool[voice] = FREE;
+}
+
+void VoiceAllocator::appendHeld(const int voice)
+{
+    prev[voice] = heldTail;
+    next[voice] = -1;
+    if (heldTail >= 0) next[heldTail] = voice;
+    else               heldHead = voice;
+    heldTail = voice;
+    pool[voice] = HELD;
+}
+
+void VoiceAllocator::removeHeld(const int voice)
+{
+    if (prev[voice] >= 0) next[prev[voice]] = next[voice];
+    else                  heldHead = next[voice];
+    if (next[voice] >= 0) prev[next[voice]] = prev[voice];
+    else                  heldTail = prev[voice];
+}
+
+void VoiceAllocator::heapPush(const int voice)
+{
+    heapSet(heapSize, voice);
+    siftUp(heapSize++);
+    pool[voice] = RELEASING;
+}
+
+void VoiceAllocator::heapRemove(const int voice)
+{
+    const int position = heapPosition[voice];
+    const int last = heap[--heapSize];
+    if (last == voice)
+        return;
+    heapSet(position, last);
+    siftUp(position);
+    siftDown(heapPosition[last]);
+}
+
+void VoiceAllocator::siftUp(int position)
+{
+    const int voice = heap[position];
+    while (position > 0)
+    {
+        const int parent = (position - 1) / 2;
+        if (releaseKey[heap[parent]] <= releaseKey[voice])
+            break;
+        heapSet(position, heap[parent]);
+        position = parent;
+    }
+    heapSet(position, voice);
+}
+
+void VoiceAllocator::siftDown(int position)
+{
+    const int voice = heap[position];
+    while (true)
+    {
+        int child = 2 * position + 1;
+        if (child >= heapSize)
+            break;
+        if (child + 1 < heapSize && releaseKey[heap[child + 1]] < releaseKey[heap[child]])
+            child++;
+        if (releaseKey[voice] <= releaseKey[heap[child]])
+            break;
+        heapSet(position, heap[child]);
+        position = child;
+    }
+    heapSet(position, voice);
+}
+
+
+// NoteStack ----------------------------------------------------------------------------------------------------------------------
+//
+
+void NoteStack::clear()
+{
+    top = -1;
+    contained.fill(false);
+}
+
+void NoteStack::push(const int note)
+{
+    remove(note);
+
+    below[note] = top;
+    above[note] = -1;
+    if (top >= 0) above[top] = note;
+    top = note;
+    contained[note] = true;
+}
+
+void NoteStack::remove(const int note)
+{
+    if (!contained[note])
+        return;
+
+    if (below[note] >= 0) above[below[note]] = above[note];
+    if (above[note] >= 0) below[above[note]] = below[note];
+    else                  top = below[note];
+    contained[note] = false;
+}
+
+
+// VoiceQueue ---------------------------------------------------------------------------------------------------------------------
+//
+
+void VoiceQueue::clear()
+{
+    head = tail = -1;
+    contained.fill(false);
+}
+
+void VoiceQueue::pushBack(const int voice)
+{
+    if (contained[voice])
+        return;
+
+    prev[voice] = tail;
+    next[voice] = -1;
+    if (tail >= 0) next[tail] = voice;
+    else           head = voice;
+    tail = voice;
+    contained[voice] = true;
+}
+
+void VoiceQueue::remove(const int voice)
+{
+    if (!contained[voice])
+        return;
+
+    if (prev[voice] >= 0) next[prev[voice]] = next[voice];
+    else                  head = next[voice];
+    if (next[voice] >= 0) prev[next[voice]] = prev[voice];
+    else                  tail = prev[voice];
+    contained[voice] = false;
+}
+
+int VoiceQueue::popFront()
+{
+    const int voice = head;
+    if (voice >= 0)
+        remove(voice);
+    return voice;
+}
@@ -0,0 +1,173 @@
+//
+//  VoiceAllocator.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include <array>
+#include "VoiceBank.hpp"
+
+/**
+ Keeps track of which voice plays which note, with constant time note-on/note-off handling.
+
+ Every voice is in exactly one pool:
+    FREE:       asleep, intrusive stack
+    HELD:       key is down, intrusive list in note-on order (oldest first, stolen first)
+    RELEASING:  key is up, min-heap by current loudness (quietest first)
+    RETIRED:    above the voice limit, still releasing
+    NONE:       above the voice limit, asleep
+
+ Changing the voice limit never touches the VoiceBank's memory, voices above the limit just stop being handed out.
+
+ Releasing voices all decay with the same release factor, so their order does not change over time. A voice's heap key
+ is its log level at note-off, moved to a common point in time with the release clock (in samples). A new release factor
+ or a rebase of the clock shifts all keys by the same amount, which keeps the heap valid.
+ */
+class VoiceAllocator
+{
+public:
+    static constexpr int MAX_VOICES = VoiceBank::MAX_VOICES;
+    static constexpr int NUM_NOTES = 128;
+
+    // All voices below numVoices become free
+    void reset(int numVoices);
+
+    // Held voices above the new limit are released through releaseVoice(voice) -> level
+    template <typename ReleaseFunction>
+    void setVoiceLimit(int numVoices, ReleaseFunction releaseVoice)
+    {
+        for (int voice = numVoices; voice < MAX_VOICES; voice++)
+        {
+            if (pool[voice] == HELD)
+                release(voice, releaseVoice(voice));
+        }
+        applyVoiceLimit(numVoices);
+    }
+
+    void setReleaseFactor(float releaseFactor);
+    void advanceReleaseClock(int numSamples);
+
+    // -1 if the note is not held
+    inline int getHeldVoice(int note) const { return noteToVoice[note]; }
+    inline int getOldestHeldVoice() const { return heldHead; }
+
+    // Free voice, else the quietest releasing voice, else -1
+    int acquire();
+
+    // Voice starts playing the note (from any pool). Another voice that still holds the note is released through
+    // releaseVoice(voice) -> level, so it never keeps playing without a note
+    template <typename ReleaseFunction>
+    void hold(int voice, int note, ReleaseFunction releaseVoice)
+    {
+        const int displaced = noteToVoice[note];
+        if (displaced >= 0 && displaced != voice)
+            release(displaced, releaseVoice(displaced));
+        assign(voice, note);
+    }
+    // Key up, level = current envelope * velocity
+    void release(int voice, float level);
+    // Release finished, voice is asleep
+    void finished(int voice);
+    // All held voices to releasing
+    template <typename LevelFunction>
+    void releaseAll(LevelFunction level)
+    {
+        while (heldHead >= 0)
+            release(heldHead, level(heldHead));
+    }
+
+private:
+    enum Pool { NONE, FREE, HELD, RELEASING, RETIRED };
+
+    int voiceLimit = 0;
+
+    std::array<int, NUM_NOTES> noteToVoice;
+    std::array<int, MAX_VOICES> voiceNote;
+    std::array<Pool, MAX_VOICES> pool;
+
+    // FREE: stack linked through next
+    int freeHead = -1;
+    // HELD: doubly linked through prev/next
+    int heldHead = -1, heldTail = -1;
+    std::array<int, MAX_VOICES> next;
+    std::array<int, MAX_VOICES> prev;
+
+    // RELEASING: binary min-heap of voices, heapPosition is the index of a voice in heap
+    std::array<int, MAX_VOICES> heap;
+    std::array<int, MAX_VOICES> heapPosition;
+    std::array<double, MAX_VOICES> releaseKey;
+    int heapSize = 0;
+
+    // Moved back to 0 after MAX_RELEASE_CLOCK samples, so the keys keep their resolution
+    static constexpr double MAX_RELEASE_CLOCK = 1 << 20;
+    double releaseClock = 0;
+    double logReleaseFactor = 0;
+    // Adds amount to the keys of all releasing and retired voices
+    void shiftReleaseKeys(double amount);
+
+    void applyVoiceLimit(int numVoices);
+    void assign(int voice, int note);
+    void remove(int voice);
+    void pushFree(int voice);
+    void appendHeld(int voice);
+    void removeHeld(int voice);
+    void heapPush(int voice);
+    void heapRemove(int voice);
+    void siftUp(int position);
+    void siftDown(int position);
+    inline void heapSet(int position, int voice) { heap[position] = voice; heapPosition[voice] = position; }
+};
+
+
+/**
+ Stack of MIDI notes with constant time removal from anywhere (intrusive list over the note numbers).
+ */
+class NoteStack
+{
+public:
+    void clear();
+
+    // Moves the note to the top if it is already in the stack
+    void push(int note);
+    void remove(int note);
+
+    inline bool isEmpty() const { return top < 0; }
+    inline int getTop() const { return top; }
+
+private:
+    static constexpr int NUM_NOTES = VoiceAllocator::NUM_NOTES;
+
+    int top = -1;
+    std::array<int, NUM_NOTES> below;
+    std::array<int, NUM_NOTES> above;
+    std::array<bool, NUM_NOTES> contained{};
+};
+
+
+/**
+ FIFO of voices without duplicates, constant time removal from anywhere (intrusive list over the voice numbers).
+ */
+class VoiceQueue
+{
+public:
+    void clear();
+
+    // Does nothing if the voice is already queued
+    void pushBack(int voice);
+    void remove(int voice);
+    // -1 if empty
+    int popFront();
+
+    inline bool isEmpty() const { return head < 0; }
+
+private:
+    static constexpr int MAX_VOICES = VoiceAllocator::MAX_VOICES;
+
+    int head = -1, tail = -1;
+    std::array<int, MAX_VOICES> next;
+    std::array<int, MAX_VOICES> prev;
+    std::array<bool, MAX_VOICES> contained{};
+};
@@ -0,0 +1,794 @@
+//
+//  VoiceBank.cpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+#include "VoiceBank.hpp"
+#include <cmath>
+
+
+VoiceBank::VoiceBank(Parameter *parameter)
+    : parameter{ parameter }
+{
+    state.fill(State::SLEEP);
+    midiNote.fill(-1);
+    showFFT.fill(false);
+    playbackSampleType.fill(SQARED_ABS);
+    activePosition.fill(-1);
+
+    prepareToPlay(sampleRate);
+}
+
+// Schrödinger equation functions -------------------------------------------------------------------------------------------------
+//
+
+// based on: http://www.articlesbyaphysicist.com/quantum4prog.html
+template <bool ShowFFT, bool UpdateTable>
+void VoiceBank::doTimestep(const int voice)
+{
+    // note: 2 FFTs are minimum, regardless of showFFT setting
+
+    cfloat* v = wavefunction[voice].data();
+    constexpr size_t n = Wavetable::SIZE;
+
+    if constexpr (ShowFFT)
+        fft(v, false);
+
+
+    // Phase factors of timestepDelta, see TableBuilder::build (or the voice's own, if its potential is modulated)
+    const DerivedTables& tables = *parameter->tables;
+    const cfloat* potentialPhaseFactors = ownPotential[voice] ? potentialPhase[voice].data() : tables.potentialPhase.data();
+
+    // "timestepV"
+    for (size_t i = 0; i < n; i++)
+    {
+        v[i] *= potentialPhaseFactors[i];
+    }
+
+    fft(v, true);
+
+    // "timestepT"
+    for (size_t i = 0; i < n; i++)
+    {
+        v[i] *= tables.kineticPhase[i];
+    }
+
+    if constexpr (!ShowFFT)
+    {
+        // v is the spectrum of the new wavefunction here, the playback table is built from it directly
+        if constexpr (UpdateTable)
+            buildPlaybackTable(voice, v);
+        fft(v, false);
+    }
+    else if constexpr (UpdateTable)
+    {
+        updatePlaybackTable(voice);
+    }
+}
+
+inline void VoiceBank::fft(cfloat* data, bool forward, size_t size)
+{
+    // (in-place, preallocated tables, no allocation)
+    // The scale stays 1/sqrt(SIZE) for larger sizes, so a zero-padded spectrum gives the same wave at more points
+    const float scale = (float)(1.0 / sqrt(Wavetable::SIZE));
+    if (size == Wavetable::SIZE) tableFFT.perform(data, forward, scale);
+    else                         playbackFFT.perform(data, forward, scale);
+}
+
+void VoiceBank::updatePlaybackTable(const int voice)
+{
+    // The played values (wavefunction, or its FFT if showFFT) as spectrum
+    std::copy(wavefunction[voice].begin(), wavefunction[voice].end(), spectrumBuffer.begin());
+    fft(spectrumBuffer.data(), true);
+
+    buildPlaybackTable(voice, spectrumBuffer.data());
+}
+
+void VoiceBank::buildPlaybackTable(const int voice, const cfloat* spectrum)
+{
+    // Convert once per timestep instead of twice per sample
+    playbackSampleType[voice] = parameter->sampleType;
+    bandLimitLevel[voice] = Wavetable::bandLimitLevel(bandLimitIncrement[voice], playbackSampleType[voice] == SQARED_ABS);
+
+    // Zero-padded spectrum, cut off above the band limit
+    constexpr size_t n = Wavetable::SIZE;
+    constexpr size_t m = Wavetable::PLAYBACK_SIZE;
+    const size_t cutoff = (n / 2) >> bandLimitLevel[voice];
+    cfloat* padded = oversampleBuffer.data();
+
+    std::fill(padded, padded + m, cfloat(0));
+    padded[0] = spectrum[0];
+    for (size_t k = 1; k <= std::min(cutoff, n / 2 - 1); k++)
+    {
+        padded[k]     = spectrum[k];
+        padded[m - k] = spectrum[n - k];
+    }
+    if (cutoff == n / 2)
+    {
+        // Nyquist bin of the small table is shared by both sides of the large one
+        padded[n / 2]     = 0.5f * spectrum[n / 2];
+        padded[m - n / 2] = 0.5f * spectrum[n / 2];
+    }
+
+    fft(padded, false, m);
+
+    switch (playbackSampleType[voice])
+    {
+        case REAL_VALUE: convertPlaybackTable<REAL_VALUE>(voice); break;
+        case IMAG_VALUE: convertPlaybackTable<IMAG_VALUE>(voice); break;
+        case SQARED_ABS: convertPlaybackTable<SQARED_ABS>(voice); break;
+    }
+
+    // wrap padding
+    float* table = playbackTable[voice].data() + Wavetable::PAD_BEFORE;
+    for (int i = 1; i <= Wavetable::PAD_BEFORE; i++)
+        table[-i] = table[m - i];
+    for (int i = 0; i < Wavetable::PAD_AFTER; i++)
+        table[m + i] = table[i];
+}
+
+template <SampleType Type>
+void VoiceBank::convertPlaybackTable(const int voice)
+{
+    const cfloat* v = oversampleBuffer.data();
+    float* table = playbackTable[voice].data() + Wavetable::PAD_BEFORE;
+
+    for (size_t i = 0; i < Wavetable::PLAYBACK_SIZE; i++)
+    {
+        if constexpr (Type == REAL_VALUE) table[i] = std::real(v[i]);
+        if constexpr (Type == IMAG_VALUE) table[i] = std::imag(v[i]);
+        if constexpr (Type == SQARED_ABS) table[i] = std::norm(v[i]);
+    }
+}
+
+void VoiceBank::copyWavefunction(const int voice, cfloat* out) const
+{
+    std::copy(wavefunction[voice].begin(), wavefunction[voice].end(), out);
+}
+
+
+// Note processing -----------------------------------------------------------------------------------------------------------------
+//
+
+void VoiceBank::prepareToPlay(const float sampleRate)
+{
+    this->sampleRate = sampleRate;
+
+    state.fill(State::SLEEP);
+    envelopeLevel.fill(0.f);
+    velocityLevel.fill(0.f);
+    playingFrequency.fill(0.f);
+    targetFrequency.fill(0.f);
+    oldFrequency.fill(0.f);
+    phase.fill(0);
+    phaseIncrement.fill(0);
+    bandLimitIncrement.fill(0);
+    bandLimitLevel.fill(0);
+    filterIc1.fill(0.f);
+    filterIc2.fill(0.f);
+    timestepCounter.fill(0);
+    timestepCountTo.fill(0);
+    noteVelocity.fill(0.f);
+    notePressure.fill(0.f);
+    channelPressure = 0;
+    lfoPhase.fill(0.f);
+    ownPotential.fill(false);
+    potentialFactor.fill(0.f);
+    potentialPhaseVersion.fill(0);
+
+    numActiveVoices = 0;
+    numFinishedVoices = 0;
+    activePosition.fill(-1);
+
+    if (parameter != nullptr)
+        resetRamps();
+}
+
+void VoiceBank::noteOn(const int voice, const int midiNote, const int velocity)
+{
+    // Do pitch stuff
+    this->midiNote[voice] = midiNote;
+    targetFrequency[voice] = Wavetable::midiNoteToFrequency(midiNote);
+    if (playingFrequency[voice] == 0) playingFrequency[voice] = targetFrequency[voice];
+    oldFrequency[voice] = playingFrequency[voice];
+
+    phaseIncrement[voice] = Wavetable::frequencyToPhaseIncrement(playingFrequency[voice], sampleRate);
+    bandLimitIncrement[voice] = phaseIncrement[voice];
+
+    if (!isNoteOn(voice)) {
+        noteVelocity[voice] = velocity / 127.f;
+        notePressure[voice] = 0;
+    }
+
+    if (!isPlaying(voice)) {
+        // The pre-start simulation already runs with the modulated potential
+        lfoPhase[voice] = 0;
+        ownPotential[voice] = parameter->isPotentialModulated();
+        if (ownPotential[voice])
+            updateVoicePotential(voice);
+
+        // generate new wavetable (cached, usually the same for every note)
+        const cfloat* initial = waveCache.generate(parameter->waveTypeNumber, parameter->waveShift, parameter->waveScale, parameter->waveFormula);
+        std::copy(initial, initial + Wavetable::SIZE, wavefunction[voice].begin());
+
+        // pre-start simulation
+        const size_t steps = parameter->preStartTimesteps;
+        for (size_t i = 0; i < steps; i++)
+        {
+            if (showFFT[voice]) doTimestep<true, false>(voice);
+            else                doTimestep<false, false>(voice);
+        }
+
+        phase[voice] = 0; // Not necessary for the sound, but helpful for null-tests
+    }
+
+    // FFT result as standard form?
+    if (parameter->showFFT)
+    {
+        fft(wavefunction[voice].data(), true);
+        showFFT[voice] = true;
+    }
+
+    updatePlaybackTable(voice);
+
+    // Do not set envelopeLevel = 0 here, to enable smooth retriggers of one note
+
+    if (!isNoteOn(voice)) {
+        velocityLevel[voice] = Decibels::decibelsToGain(-20 + 20 * velocity / 127.f); // TODO: Rethink velocity sensitivity
+    }
+    state[voice] = State::ATTACK;
+
+    if (envelopeLevel[voice] < Parameter::ATTACK_THRESHOLD)
+    {
+        envelopeLevel[voice] = Parameter::ATTACK_THRESHOLD;
+    }
+
+    activate(voice);
+}
+
+void VoiceBank::noteOff(const int voice)
+{
+    state[voice] = State::RELEASE;
+}
+
+void VoiceBank::setPressure(const int voice, const float pressure)
+{
+    notePressure[voice] = pressure;
+}
+
+void VoiceBank::setChannelPressure(const float pressure)
+{
+    channelPressure = pressure;
+}
+
+// Potential modulation -----------------------------------------------------------------------------------------------------------
+//
+
+void VoiceBank::updatePotentialModulation(const int numSamples)
+{
+    const bool modulated = parameter->isPotentialModulated();
+    const float lfoIncrement = parameter->potentialLfoRate * numSamples / sampleRate;
+
+    for (int a = 0; a < numActiveVoices; a++)
+    {
+        const int voice = activeVoices[a];
+        ownPotential[voice] = modulated;
+        if (!modulated)
+            continue;
+
+        updateVoicePotential(voice);
+        lfoPhase[voice] += lfoIncrement;
+        lfoPhase[voice] -= std::floor(lfoPhase[voice]);
+    }
+}
+
+void VoiceBank::updateVoicePotential(const int voice)
+{
+    const DerivedTables& tables = *parameter->tables;
+    const float pressure = std::max(notePressure[voice], channelPressure);
+    const float factor = (1 + parameter->potentialVelocity * (2 * noteVelocity[voice] - 1))
+                       * (1 + parameter->potentialPressure * pressure)
+                       * (1 + parameter->potentialLfoDepth * std::sin(Wavetable::TWO_PI * lfoPhase[voice]));
+
+    if (factor == potentialFactor[voice] && tables.phaseVersion == potentialPhaseVersion[voice])
+        return;
+    potentialFactor[voice] = factor;
+    potentialPhaseVersion[voice] = tables.phaseVersion;
+
+    // exp(i dt factor V), the shared potentialPhase scaled per voice
+    constexpr size_t n = Wavetable::SIZE;
+    alignas(32) float angle[n];
+    const float scale = tables.timestepDelta * factor;
+    for (size_t i = 0; i < n; i++)
+        angle[i] = scale * tables.potential[i];
+    FastMath::polar<n>(angle, potentialPhase[voice].data());
+}
+
+void VoiceBank::activate(const int voice)
+{
+    if (activePosition[voice] >= 0)
+        return;
+    activePosition[voice] = numActiveVoices;
+    activeVoices[numActiveVoices++] = voice;
+}
+
+void VoiceBank::removeSleepingVoices()
+{
+    numFinishedVoices = 0;
+    for (int a = 0; a < numActiveVoices; )
+    {
+        const int voice = activeVoices[a];
+        if (isPlaying(voice))
+        {
+            a++;
+            continue;
+        }
+        // swap with last
+        finishedVoices[numFinishedVoices++] = voice;
+        activePosition[voice] = -1;
+        filterIc1[voice] = 0.f;
+        filterIc2[voice] = 0.f;
+        const int last = activeVoices[--numActiveVoices];
+        if (last != voice)
+        {
+            activeVoices[a] = last;
+            activePosition[last] = a;
+        }
+    }
+}
+
+
+// Sample processing ---------------------------------------------------------------------------------------------------------------
+//
+
+void VoiceBank::render(float* left, float* right, const int numSamples)
+{
+    jassert(numSamples <= RENDER_BLOCK_SIZE);
+
+    updatePowerTables();
+
+    // Silence: nothing to mix, the smoothers only keep up with the parameters
+    if (numActiveVoices == 0)
+    {
+        numFinishedVoices = 0;
+        skipRamps(numSamples);
+        return;
+    }
+
+    renderRamps(numSamples);
+    updatePotentialModulation(numSamples);
+
+    // Stage 1: oscillators
+    for (int a = 0; a < numActiveVoices; a++)
+    {
+        renderOscillator(activeVoices[a], voiceBuffer[a].data(), panLeftBuffer[a].data(), panRightBuffer[a].data(), numSamples);
+    }
+
+    // Stage 2: envelope, then filter across voices
+    applyEnvelope(numSamples);
+    applyFilter(numSamples);
+
+    // Stage 3: pan and mix, then the gain for all voices at once
+    FloatVectorOperations::clear(mixLeft.data(), numSamples);
+    FloatVectorOperations::clear(mixRight.data(), numSamples);
+    for (int a = 0; a < numActiveVoices; a++)
+    {
+        FloatVectorOperations::addWithMultiply(mixLeft.data(), voiceBuffer[a].data(), panLeftBuffer[a].data(), numSamples);
+        FloatVectorOperations::addWithMultiply(mixRight.data(), voiceBuffer[a].data(), panRightBuffer[a].data(), numSamples);
+    }
+    FloatVectorOperations::addWithMultiply(left, mixLeft.data(), gainRamp.data(), numSamples);
+    FloatVectorOperations::addWithMultiply(right, mixRight.data(), gainRamp.data(), numSamples);
+
+    removeSleepingVoices();
+}
+
+void VoiceBank::renderOscillator(const int voice, float* out, float* panLeft, float* panRight, const int numSamples)
+{
+    // Schrödinger parameter changed?
+    if (parameter->samplesPerTimestep != timestepCountTo[voice])
+    {
+        timestepCountTo[voice] = parameter->samplesPerTimestep;
+        timestepCounter[voice] = 0;
+    }
+
+    // Portamento off: jump to target immediately
+    if (targetFrequency[voice] != playingFrequency[voice] && parameter->portamentoTime == 0)
+    {
+        playingFrequency[voice] = targetFrequency[voice];
+        phaseIncrement[voice] = Wavetable::frequencyToPhaseIncrement(playingFrequency[voice], sampleRate);
+    }
+
+    // Decide once per chunk which kernel runs (quiet voices may pause the simulation on overload)
+    const bool simulate = parameter->applyWavefunction && !(parameter->throttleQuietVoices && isQuiet(voice));
+    const bool multipleStepsPerSample = timestepCountTo[voice] < 1;
+    const bool gliding = targetFrequency[voice] != playingFrequency[voice];
+
+    const uint32 startIncrement = phaseIncrement[voice];
+    if (gliding)
+        renderGlide(voice, numSamples);
+
+    // Band limit for the highest pitch in this chunk
+    bandLimitIncrement[voice] = std::max(startIncrement, phaseIncrement[voice]);
+
+    // sample type or band limit changed while playing?
+    if (parameter->sampleType != playbackSampleType[voice]
+        || Wavetable::bandLimitLevel(bandLimitIncrement[voice], parameter->sampleType == SQARED_ABS) != bandLimitLevel[voice])
+        updatePlaybackTable(voice);
+
+    dispatchKernel(voice, out, panLeft, panRight, numSamples, simulate, multipleStepsPerSample, gliding, showFFT[voice]);
+}
+
+template <bool... Flags, typename... Rest>
+inline void VoiceBank::dispatchKernel(const int voice, float* out, float* panLeft, float* panRight, const int numSamples, const bool flag, Rest... rest)
+{
+    if (flag)
+        dispatchKernel<Flags..., true>(voice, out, panLeft, panRight, numSamples, rest...);
+    else
+        dispatchKernel<Flags..., false>(voice, out, panLeft, panRight, numSamples, rest...);
+}
+
+template <bool... Flags>
+inline void VoiceBank::dispatchKernel(const int voice, float* out, float* panLeft, float* panRight, const int numSamples)
+{
+    renderKernel<Flags...>(voice, out, panLeft, panRight, numSamples);
+}
+
+template <bool Simulate, bool MultipleStepsPerSample, bool Gliding, bool ShowFFT>
+void VoiceBank::renderKernel(const int voice, float* out, float* panLeft, float* panRight, const int numSamples)
+{
+    const float* table = playbackTable[voice].data() + Wavetable::PAD_BEFORE;
+
+    // Work on locals, write back at the end
+    double counter = timestepCounter[voice];
+    const double countTo = timestepCountTo[voice];
+    uint32 p = phase[voice];
+    const uint32 increment = phaseIncrement[voice];
+
+    // The table only changes with a timestep, so the samples between two timesteps are read in one run
+    int sample = 0;
+    while (sample < numSamples)
+    {
+        int runLength = numSamples - sample;
+
+        // Schrödinger
+        if constexpr (Simulate)
+        {
+            // multiple timesteps per sample?
+            if constexpr (MultipleStepsPerSample)
+            {
+                // Only the last timestep before the sample is played, the others skip the playback table
+                if (counter < 1)
+                {
+                    for (counter += countTo; counter < 1; counter += countTo)
+                        doTimestep<ShowFFT, false>(voice);
+                    doTimestep<ShowFFT, true>(voice);
+                }
+                counter = fmod(counter, countTo);
+                runLength = 1;
+            }
+            // multiple samples pass before timestep?
+            else
+            {
+                counter += 1;
+                if (counter >= countTo)
+                {
+                    doTimestep<ShowFFT>(voice);
+                    counter -= countTo;
+                }
+                // extend the run up to the sample before the next timestep
+                runLength = 1;
+                while (sample + runLength < numSamples && counter + 1 < countTo)
+                {
+                    counter += 1;
+                    runLength++;
+                }
+            }
+        }
+
+        // Audio calculations
+        //
+        const uint32* glideIncrements = glideIncrementBuffer.data() + sample;
+        switch (parameter->interpolation)
+        {
+            case LINEAR:       p = readRun<LINEAR, Gliding>(table, p, increment, glideIncrements, out + sample, panLeft + sample, panRight + sample, runLength); break;
+            case HERMITE_4:    p = readRun<HERMITE_4, Gliding>(table, p, increment, glideIncrements, out + sample, panLeft + sample, panRight + sample, runLength); break;
+            case POLYNOMIAL_6: p = readRun<POLYNOMIAL_6, Gliding>(table, p, increment, glideIncrements, out + sample, panLeft + sample, panRight + sample, runLength); break;
+        }
+        sample += runLength;
+    }
+
+    timestepCounter[voice] = counter;
+    phase[voice] = p;
+}
+
+template <Interpolation Type, bool Gliding>
+inline uint32 VoiceBank::readRun(const float* table, const uint32 p, const uint32 increment, const uint32* glideIncrements, float* out, float* panLeft, float* panRight, const int numSamples)
+{
+    const float* stereoLeft = parameter->tables->stereoLeft.data();
+    const float* stereoRight = parameter->tables->stereoRight.data();
+
+    // Phase of each sample: in closed form at a fixed frequency, accumulated while gliding.
+    // Frequency glides towards targetFrequency, increments were prepared by renderGlide
+    uint32 glidePhase = p;
+    for (int sample = 0; sample < numSamples; ++sample)
+    {
+        uint32 samplePhase;
+        if constexpr (Gliding)
+        {
+            samplePhase = glidePhase;
+            glidePhase += glideIncrements[sample];
+        }
+        else
+        {
+            samplePhase = p + static_cast<uint32>(sample) * increment;
+        }
+
+        const uint32 index = samplePhase >> Wavetable::PHASE_FRACTION_BITS;
+        const float fraction = (samplePhase & Wavetable::PHASE_FRACTION_MASK) * Wavetable::PHASE_FRACTION_SCALE;
+        out[sample] = Wavetable::interpolate<Type>(table, index, fraction);
+
+        // Phase-dependent stereo weights, one per wavefunction point
+        panLeft[sample] = stereoLeft[index >> Wavetable::OVERSAMPLING_BITS];
+        panRight[sample] = stereoRight[index >> Wavetable::OVERSAMPLING_BITS];
+    }
+
+    if constexpr (Gliding)
+        return glidePhase;
+    else
+        return p + static_cast<uint32>(numSamples) * increment;
+}
+
+void VoiceBank::renderGlide(const int voice, const int numSamples)
+{
+    // Linear glide from oldFrequency to targetFrequency in portamentoTime seconds.
+    // After k samples: playing + k * step, until it passes the target (it may overshoot for one sample, then snaps).
+    const float playing = playingFrequency[voice];
+    const float target = targetFrequency[voice];
+    const float step = (target - oldFrequency[voice]) / parameter->portamentoTime / sampleRate;
+
+    const float remaining = (step != 0) ? (target - playing) / step : 0;
+    const int glideSamples = remaining > 0 ? static_cast<int>(std::min(std::ceil(remaining), (float)RENDER_BLOCK_SIZE + 1)) : 0;
+
+    const double toIncrement = std::ldexp(1.0 / sampleRate, 32);
+    for (int sample = 0; sample < numSamples; sample++)
+    {
+        const int k = sample + 1;
+        const float frequency = k <= glideSamples ? playing + k * step : target;
+        glideIncrementBuffer[sample] = static_cast<uint32>(std::min(frequency * toIncrement, 4294967295.0));
+    }
+
+    playingFrequency[voice] = numSamples <= glideSamples ? playing + numSamples * step : target;
+    phaseIncrement[voice] = glideIncrementBuffer[numSamples - 1];
+}
+
+void VoiceBank::resetRamps()
+{
+    const auto reset = [this](auto& smoother, const float value)
+    {
+        smoother.reset(sampleRate, SMOOTHING_TIME);
+        smoother.setCurrentAndTargetValue(value);
+    };
+
+    reset(gainSmoother, parameter->gainFactor);
+    reset(cutoffSmoother, parameter->filterFreq / sampleRate);
+    reset(dampingSmoother, 1.f / parameter->filterQ);
+    reset(filterEnvelopeSmoother, parameter->filterEnvelope);
+    reset(sustainSmoother, parameter->sustainLevel);
+}
+
+void VoiceBank::renderRamps(const int numSamples)
+{
+    const auto render = [numSamples](auto& smoother, const float target, float* ramp)
+    {
+        smoother.setTargetValue(target);
+        if (!smoother.isSmoothing())
+        {
+            FloatVectorOperations::fill(ramp, smoother.getTargetValue(), numSamples);
+            return;
+        }
+        for (int sample = 0; sample < numSamples; sample++)
+            ramp[sample] = smoother.getNextValue();
+    };
+
+    render(gainSmoother, parameter->gainFactor, gainRamp.data());
+    render(cutoffSmoother, parameter->filterFreq / sampleRate, cutoffRamp.data());
+    render(dampingSmoother, 1.f / parameter->filterQ, dampingRamp.data());
+    render(filterEnvelopeSmoother, parameter->filterEnvelope, filterEnvelopeRamp.data());
+    render(sustainSmoother, parameter->sustainLevel, sustainRamp.data());
+}
+
+void VoiceBank::skipRamps(const int numSamples)
+{
+    const auto skip = [numSamples](auto& smoother, const float target)
+    {
+        smoother.setTargetValue(target);
+        smoother.skip(numSamples);
+    };
+
+    skip(gainSmoother, parameter->gainFactor);
+    skip(cutoffSmoother, parameter->filterFreq / sampleRate);
+    skip(dampingSmoother, 1.f / parameter->filterQ);
+    skip(filterEnvelopeSmoother, parameter->filterEnvelope);
+    skip(sustainSmoother, parameter->sustainLevel);
+}
+
+void VoiceBank::applyEnvelope(const int numSamples)
+{
+    // Cutoff as ratio of the sample rate, the filter does the prewarping
+    const float* baseCutoff = cutoffRamp.data();
+    const float* filterEnvelope = filterEnvelopeRamp.data();
+    const float* sustainLevel = sustainRamp.data();
+
+    for (int a = 0; a < numActiveVoices; a++)
+    {
+        const int voice = activeVoices[a];
+        float* buffer = voiceBuffer[a].data();
+        float* filterGain = filterGainBuffer[a].data();
+        const float* levels = envelopeBuffer.data();
+
+        renderEnvelope(voice, envelopeBuffer.data(), numSamples);
+
+        // Amplitude follows the level before each envelope step
+        FloatVectorOperations::multiply(buffer, levels, numSamples);
+        FloatVectorOperations::multiply(buffer, velocityLevel[voice], numSamples);
+
+        // Low pass, cutoff follows the level after each step
+        for (int sample = 0; sample < numSamples; ++sample)
+        {
+            const float cutoffEnvelope = baseCutoff[sample] * filterEnvelope[sample];
+            const float minCutoff = baseCutoff[sample] * 0.25f;
+            const float cutoff = std::max(baseCutoff[sample] + cutoffEnvelope * (levels[sample + 1] - sustainLevel[sample]), minCutoff);
+            filterGain[sample] = StateVariableFilter::cutoffToGain(cutoff);
+        }
+    }
+}
+
+void VoiceBank::applyFilter(const int numSamples)
+{
+    constexpr int LANES = FILTER_LANES;
+    const float* damping = dampingRamp.data();
+
+    for (int group = 0; group < numActiveVoices; group += LANES)
+    {
+        const int lanesUsed = std::min(LANES, numActiveVoices - group);
+
+        // Unused lanes filter silence and are not written back
+        alignas(32) float ic1[LANES] = {};
+        alignas(32) float ic2[LANES] = {};
+        alignas(32) float in[LANES] = {};
+        alignas(32) float g[LANES] = {};
+
+        for (int lane = 0; lane < lanesUsed; lane++)
+        {
+            const int voice = activeVoices[group + lane];
+            ic1[lane] = filterIc1[voice];
+            ic2[lane] = filterIc2[voice];
+        }
+
+        for (int sample = 0; sample < numSamples; ++sample)
+        {
+            for (int lane = 0; lane < lanesUsed; lane++)
+            {
+                in[lane] = voiceBuffer[group + lane][sample];
+                g[lane] = filterGainBuffer[group + lane][sample];
+            }
+
+            StateVariableFilter::processLowPass<LANES>(in, g, damping[sample], ic1, ic2);
+
+            for (int lane = 0; lane < lanesUsed; lane++)
+                voiceBuffer[group + lane][sample] = in[lane];
+        }
+
+        const auto cut = [](const float state) { return std::abs(state) < FILTER_STATE_CUTOFF ? 0.f : state; };
+        for (int lane = 0; lane < lanesUsed; lane++)
+        {
+            const int voice = activeVoices[group + lane];
+            filterIc1[voice] = cut(ic1[lane]);
+            filterIc2[voice] = cut(ic2[lane]);
+        }
+    }
+}
+
+void VoiceBank::updatePowerTables()
+{
+    const auto update = [](std::array<float, RENDER_BLOCK_SIZE + 1>& table, float& tableFactor, const float factor)
+    {
+        if (factor == tableFactor)
+            return;
+        for (size_t n = 0; n < table.size(); n++)
+            table[n] = static_cast<float>(std::pow(static_cast<double>(factor), static_cast<double>(n)));
+        tableFactor = factor;
+    };
+
+    update(attackPower, attackPowerFactor, 1 + parameter->attackFactor);
+    update(decayPower, decayPowerFactor, 1 - parameter->decayFactor);
+    update(releasePower, releasePowerFactor, parameter->releaseFactor);
+}
+
+void VoiceBank::renderEnvelope(const int voice, float* levels, const int numSamples)
+{
+    levels[0] = envelopeLevel[voice];
+
+    int done = 0;
+    while (done < numSamples)
+    {
+        done += renderEnvelopeSegment(voice, levels + done, sustainRamp.data() + done, numSamples - done);
+    }
+
+    envelopeLevel[voice] = levels[numSamples];
+}
+
+// Fills levels[1..n] from levels[0] for up to numSamples steps of the current state, in closed form.
+// Returns n; if the state ended within numSamples, the state is switched and n is the sample it ended at.
+int VoiceBank::renderEnvelopeSegment(const int voice, float* levels, const float* sustainLevels, const int numSamples)
+{
+    const float start = levels[0];
+
+    // First step (1..numSamples) at which endsAt(step) is true, numSamples + 1 if none
+    const auto findEnd = [numSamples](auto endsAt)
+    {
+        int low = 1, high = numSamples + 1;
+        while (low < high)
+        {
+            const int mid = (low + high) / 2;
+            if (endsAt(mid)) high = mid;
+            else             low = mid + 1;
+        }
+        return low;
+    };
+
+    switch (state[voice]) {
+        case State::SLEEP:
+        case State::SUSTAIN:
+            std::fill(levels + 1, levels + numSamples + 1, start);
+            return numSamples;
+
+        case State::ATTACK:
+        {
+            // level grows by attackFactor per sample until it reaches 1
+            const int end = findEnd([&](int n) { return start * attackPower[n] >= 1.f; });
+            const int count = std::min(end - 1, numSamples);
+            for (int n = 1; n <= count; n++)
+                levels[n] = start * attackPower[n];
+            if (end > numSamples)
+                return numSamples;
+            levels[end] = 1.f;
+            state[voice] = State::DECAY;
+            return end;
+        }
+
+        case State::DECAY:
+        {
+            // distance to the sustain level shrinks by decayFactor per sample until it is below the threshold
+            // sustain level smoothed, taken at the start of the segment
+            const float sustain = sustainLevels[0];
+            const float difference = start - sustain;
+            const int end = findEnd([&](int n) { return difference * decayPower[n - 1] < Parameter::DECAY_THRESHOLD * 0.01f; });
+            const int count = std::min(end - 1, numSamples);
+            for (int n = 1; n <= count; n++)
+                levels[n] = sustain + difference * decayPower[n];
+            if (end > numSamples)
+                return numSamples;
+            levels[end] = sustain;
+            state[voice] = State::SUSTAIN;
+            return end;
+        }
+
+        case State::RELEASE:
+        {
+            // Is done playing?
+            // Make threshold even smaller to keep playing super quietly after the set release time
+            const int end = findEnd([&](int n) { return start * releasePower[n] < Parameter::RELEASE_THRESHOLD * 0.01f; });
+            const int count = std::min(end - 1, numSamples);
+            for (int n = 1; n <= count; n++)
+                levels[n] = start * releasePower[n];
+            if (end > numSamples)
+                return numSamples;
+            levels[end] = 0;
+            state[voice] = State::SLEEP;
+            return end;
+        }
+    }
+    return numSamples;
+}
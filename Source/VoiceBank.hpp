@@ -0,0 +1,211 @@
+//
+//  VoiceBank.hpp
+//  QSynthi
+//
+//  Created by Arthur on 19.10.26.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <complex>
+#include <array>
+#include "list.hpp"
+#include "Parameter.h"
+#include "Wavetable.hpp"
+#include "StateVariableFilter.hpp"
+#include "FFT.hpp"
+#include "DerivedTables.hpp"
+#include "FastMath.h"
+
+enum class State {
+    SLEEP,
+    ATTACK,
+    DECAY,
+    SUSTAIN,
+    RELEASE,
+};
+
+/**
+ All voices of the synth as structure of arrays: every per-voice value lives in a contiguous array indexed by the voice
+ number, and the voices that are not asleep are listed densely in activeVoices.
+
+ Rendering a chunk runs in three stages:
+    1. oscillators: per active voice, simulation + table readout in runs between timesteps
+    2. envelope per voice (whole segments in closed form), then the filter per sample across groups of FILTER_LANES voices
+    3. pan and mix: per active voice, with vector operations, then the gain once for the sum
+ Continuous parameters (gain, filter, sustain) are smoothed and rendered as ramps before stage 1.
+ Modulated potentials are refreshed per voice at the same point, once per render call.
+ */
+class VoiceBank
+{
+public:
+    static constexpr int MAX_VOICES = 64;
+    static constexpr int RENDER_BLOCK_SIZE = 256;   // max samples per render call
+
+    // Voices filtered together in one vector register
+#if defined(__AVX__)
+    static constexpr int FILTER_LANES = 8;
+#else
+    static constexpr int FILTER_LANES = 4;
+#endif
+
+    VoiceBank(Parameter *parameter);
+    VoiceBank() {}
+
+    // Initializer
+    void prepareToPlay(float sampleRate);
+
+    // MIDI
+    void noteOn(int voice, int midiNote, int velocity);
+    void noteOff(int voice);
+    // Pressure 0..1 for the potential modulation: polyphonic aftertouch of one voice, channel pressure of all
+    void setPressure(int voice, float pressure);
+    void setChannelPressure(float pressure);
+
+    inline bool isPlaying(int voice) const { return state[voice] != State::SLEEP; }
+    inline bool isNoteOn(int voice) const { return state[voice] != State::SLEEP && state[voice] != State::SUSTAIN; }
+    inline bool isQuiet(int voice) const { return envelopeLevel[voice] * velocityLevel[voice] < Parameter::QUIET_VOICE_LEVEL; }
+    inline int getMidiNote(int voice) const { return midiNote[voice]; }
+    inline float getLevel(int voice) const { return envelopeLevel[voice] * velocityLevel[voice]; }
+
+    // Voices that are not asleep, render(...) only advances the smoothed parameters while this is 0
+    inline int getNumActiveVoices() const { return numActiveVoices; }
+    // Voices that fell asleep during the last render call
+    inline int getNumFinishedVoices() const { return numFinishedVoices; }
+    inline int getFinishedVoice(int index) const { return finishedVoices[index]; }
+
+    // Copies the voice's wavefunction (Wavetable::SIZE values) to out
+    void copyWavefunction(int voice, cfloat* out) const;
+
+    // Adds numSamples (at most RENDER_BLOCK_SIZE) samples of all active voices to left and right
+    void render(float* left, float* right, int numSamples);
+
+private:
+    Parameter *parameter = nullptr;
+    float sampleRate = 44100.f;
+
+    // Voice state ----------------------------------------------------------------------------------
+    std::array<State, MAX_VOICES> state;
+    std::array<int, MAX_VOICES> midiNote;
+    std::array<bool, MAX_VOICES> showFFT;          // mirrors parameter on start, stays the same while playing
+    std::array<SampleType, MAX_VOICES> playbackSampleType;
+
+    alignas(64) std::array<float, MAX_VOICES> envelopeLevel;
+    alignas(64) std::array<float, MAX_VOICES> velocityLevel;
+
+    alignas(64) std::array<float, MAX_VOICES> oldFrequency;
+    alignas(64) std::array<float, MAX_VOICES> targetFrequency;
+    alignas(64) std::array<float, MAX_VOICES> playingFrequency;
+    alignas(64) std::array<uint32, MAX_VOICES> phase;              // fixed-point, see Wavetable::PHASE_FRACTION_BITS
+    alignas(64) std::array<uint32, MAX_VOICES> phaseIncrement;
+    alignas(64) std::array<uint32, MAX_VOICES> bandLimitIncrement;    // highest increment of the current chunk
+    std::array<int, MAX_VOICES> bandLimitLevel;                      // see Wavetable::BANDLIMIT_LEVELS
+
+    // Filter state (integrators of the StateVariableFilter). Ringing states are cut to 0 below FILTER_STATE_CUTOFF after
+    // each chunk (long before they turn subnormal) and cleared when the voice falls asleep
+    static constexpr float FILTER_STATE_CUTOFF = 1.0e-12f;
+    alignas(64) std::array<float, MAX_VOICES> filterIc1;
+    alignas(64) std::array<float, MAX_VOICES> filterIc2;
+
+    // Potential modulation: voices with ownPotential use their own phase factors exp(i dt factor V) instead of the shared
+    // ones, refreshed once per render call (control rate) when the factor or the shared tables changed
+    std::array<float, MAX_VOICES> noteVelocity;     // 0..1
+    std::array<float, MAX_VOICES> notePressure;     // 0..1
+    float channelPressure = 0;
+    alignas(64) std::array<float, MAX_VOICES> lfoPhase;         // 0..1
+    std::array<bool, MAX_VOICES> ownPotential;
+    std::array<float, MAX_VOICES> potentialFactor;              // factor of potentialPhase
+    std::array<uint32, MAX_VOICES> potentialPhaseVersion;       // DerivedTables::phaseVersion of potentialPhase
+    alignas(64) std::array<std::array<cfloat, Wavetable::SIZE>, MAX_VOICES> potentialPhase;
+    void updatePotentialModulation(int numSamples);
+    void updateVoicePotential(int voice);
+
+    // Schrödinger
+    alignas(64) std::array<double, MAX_VOICES> timestepCounter;
+    alignas(64) std::array<double, MAX_VOICES> timestepCountTo;
+    alignas(64) std::array<std::array<cfloat, Wavetable::SIZE>, MAX_VOICES> wavefunction;
+
+    // Converted wavefunction for playback: oversampled and band limited from its spectrum,
+    // padded on both sides to wrap without modulo (see Wavetable::PAD_BEFORE)
+    alignas(64) std::array<std::array<float, Wavetable::PADDED_SIZE>, MAX_VOICES> playbackTable;
+
+    // Dense index of the voices that are not asleep
+    std::array<int, MAX_VOICES> activeVoices;
+    std::array<int, MAX_VOICES> activePosition;    // voice -> position in activeVoices, -1 if asleep
+    int numActiveVoices = 0;
+    std::array<int, MAX_VOICES> finishedVoices;
+    int numFinishedVoices = 0;
+    void activate(int voice);
+    void removeSleepingVoices();
+
+    // Scratch, one row per position in activeVoices
+    alignas(64) std::array<std::array<float, RENDER_BLOCK_SIZE>, MAX_VOICES> voiceBuffer;
+    alignas(64) std::array<std::array<float, RENDER_BLOCK_SIZE>, MAX_VOICES> panLeftBuffer;
+    alignas(64) std::array<std::array<float, RENDER_BLOCK_SIZE>, MAX_VOICES> panRightBuffer;
+    alignas(64) std::array<std::array<float, RENDER_BLOCK_SIZE>, MAX_VOICES> filterGainBuffer;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE + 1> envelopeBuffer;     // level before each sample + level after the last
+    alignas(64) std::array<uint32, RENDER_BLOCK_SIZE> glideIncrementBuffer;  // phase increment after each sample while gliding
+
+    // Smoothed continuous parameters, rendered once per chunk as one value per sample and shared by all voices
+    static constexpr double SMOOTHING_TIME = 0.02;     // seconds
+    SmoothedValue<float, ValueSmoothingTypes::Multiplicative> gainSmoother;
+    SmoothedValue<float, ValueSmoothingTypes::Multiplicative> cutoffSmoother;     // filterFreq / sampleRate
+    SmoothedValue<float> dampingSmoother;                                           // 1 / filterQ
+    SmoothedValue<float> filterEnvelopeSmoother;
+    SmoothedValue<float> sustainSmoother;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> gainRamp;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> cutoffRamp;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> dampingRamp;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> filterEnvelopeRamp;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> sustainRamp;
+    void resetRamps();
+    void renderRamps(int numSamples);
+    void skipRamps(int numSamples);     // same end state as renderRamps, without the ramps
+
+    // Sum of all voices before the gain
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> mixLeft;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE> mixRight;
+
+    // factor^n for n = 0..RENDER_BLOCK_SIZE, rebuilt when the factors in Parameter change
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE + 1> attackPower;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE + 1> decayPower;
+    alignas(64) std::array<float, RENDER_BLOCK_SIZE + 1> releasePower;
+    float attackPowerFactor = -1, decayPowerFactor = -1, releasePowerFactor = -1;
+    void updatePowerTables();
+
+
+    template <bool ShowFFT, bool UpdateTable = true> void doTimestep(int voice);
+    inline void fft(cfloat* data, bool forward, size_t size = Wavetable::SIZE);
+    FFT tableFFT{ Wavetable::SIZE };
+    FFT playbackFFT{ Wavetable::PLAYBACK_SIZE };
+
+    WavetableCache waveCache;
+
+    // Scratch for the playback table
+    std::array<cfloat, Wavetable::SIZE> spectrumBuffer;
+    std::array<cfloat, Wavetable::PLAYBACK_SIZE> oversampleBuffer;
+
+    void updatePlaybackTable(int voice);
+    void buildPlaybackTable(int voice, const cfloat* spectrum);
+    template <SampleType Type> void convertPlaybackTable(int voice);
+
+    // Stage 1: oscillator kernels, one instantiation per mode combination. The mode is chosen once per chunk.
+    void renderOscillator(int voice, float* out, float* panLeft, float* panRight, int numSamples);
+    template <bool... Flags, typename... Rest>
+    inline void dispatchKernel(int voice, float* out, float* panLeft, float* panRight, int numSamples, bool flag, Rest... rest);
+    template <bool... Flags>
+    inline void dispatchKernel(int voice, float* out, float* panLeft, float* panRight, int numSamples);
+    template <bool Simulate, bool MultipleStepsPerSample, bool Gliding, bool ShowFFT>
+    void renderKernel(int voice, float* out, float* panLeft, float* panRight, int numSamples);
+    void renderGlide(int voice, int numSamples);
+    // Reads numSamples from a table without timestep in between, returns the phase after the run
+    template <Interpolation Type, bool Gliding>
+    inline uint32 readRun(const float* table, uint32 p, uint32 increment, const uint32* glideIncrements, float* out, float* panLeft, float* panRight, int numSamples);
+
+    // Stage 2
+    void applyEnvelope(int numSamples);
+    void applyFilter(int numSamples);
+    void renderEnvelope(int voice, float* levels, int numSamples);
+    int renderEnvelopeSegment(int voice, float* levels, const float* sustainLevels, int numSamples);
+};
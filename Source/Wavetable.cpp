@@ -1,134 +1,183 @@
 #include "Wavetable.hpp"
 #include "Parameter.h"
 
+static_assert(Formula::SIZE == Wavetable::SIZE, "Formulas must fill a whole wavetable");
 
-list<cfloat> Wavetable::generate(const size_t type, const float shift, const float scale)
+
+list<cfloat> Wavetable::generate(const size_t type, const float shift, const float scale, const Formula* formula)
+{
+    std::vector<cfloat> wave(SIZE);
+    generate(type, shift, scale, wave.data(), formula);
+    return list<cfloat>(wave);
+}
+
+void Wavetable::generate(const size_t type, const float shift, const float scale, cfloat* out, const Formula* formula)
 {
     // Assert that the wavetype is defined
     jassert(type >= 0 && type < Parameter::WAVE_TYPES.size());
 
+    // Shapes are evaluated in passes over the whole table: everything that only depends on shift and scale
+    // (curve parameters, normalization from the endpoints) is computed once, the element passes are
+    // branch-free so the compiler can vectorize them
+    alignas(32) float x[SIZE];      // position relative to the shifted center
+    alignas(32) float y[SIZE];
+    const float shiftOffset = 0.5f * shift;
+    for (size_t i = 0; i < SIZE; i++)
+        x[i] = i / SIZE_F - 0.5f - shiftOffset;
+
+    // Endpoints x(0) and x(1) for the normalization
+    const float left = -0.5f - shiftOffset;
+    const float right = 0.5f - shiftOffset;
+
     switch (type)
     {
         case WaveType::GAUSSIAN:
-            return list<cfloat>(SIZE, [shift, scale] (size_t i) {
-                
-                float min = std::min(gaussianCurve(0, shift, scale), gaussianCurve(1, shift, scale));
-                return (gaussianCurve(i / SIZE_F, shift, scale) - min) / (1 - min);
-                
-            });
+        {
+            // Like in Desmos
+            const float width = std::exp(-1.75f * scale + 2.75f) * (1 / std::sqrt(2.f));
+            const auto curve = [width](float x) { const float s = width * x; return std::exp(-s * s); };
+
+            const float min = std::min(curve(left), curve(right));
+            const float normalize = 1 / (1 - min);
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = curve(x[i]);
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = (y[i] - min) * normalize;
+            break;
+        }
 
         case WaveType::SINE:
-            return list<cfloat>(SIZE, [shift, scale] (size_t i) {
-                
-                float sineScale = pow(7, -scale);
-                float factor = (sineScale * (1 + abs(shift))) < 0.5f ? 1 / std::max(sineCurve(0, shift, sineScale), abs(sineCurve(1, shift, sineScale))) : 1;
-                return factor * sineCurve(i / SIZE_F, shift, sineScale);
-                
-            });
-
         case WaveType::COSINE:
-            return list<cfloat>(SIZE, [shift, scale] (size_t i) {
-                
-                float cosScale = pow(7, -scale);
-                if (cosScale * (1 + abs (shift)) < 1) {
-                    float offset = 2 / (1 - std::min(cosCurve(0, shift, cosScale), cosCurve(1, shift, cosScale)));
-                    return - offset * cosCurve(i / SIZE_F, shift, cosScale) - 1 + offset;
-                } else {
-                    return -cosCurve(i / SIZE_F, shift, cosScale);
-                }
-                
-            });
-            
-        case WaveType::PARABOLA:
-            return list<cfloat>(SIZE, [shift, scale] (size_t i) {
-            
-                float max = std::max(parabolaCurve(0, shift, scale), parabolaCurve(1, shift, scale));
-                return parabolaCurve(i / SIZE_F, shift, scale) / max;
-                
-            });
-            
-        case WaveType::BARRIER:
-            return list<cfloat>(SIZE, [shift, scale](size_t i) {
-                
-                if (i == SIZE / 2) return 99.f;
-                // else parabola
-                float scaledX = i / SIZE_F - 0.5f - 0.5f * shift;
-                return 4 * scale / (1 + 3 * shift) * scaledX * scaledX;
-                
-            });
-            
-        case WaveType::SAWTOOTH:
-            return list<cfloat>(SIZE, [shift, scale] (size_t i) {
-                
-                return sawtoothCurve(i / SIZE_F, shift, scale);
-                
-            });
-            
         case WaveType::SQUARE:
-            return list<cfloat>(SIZE, [shift, scale] (size_t i) {
+        {
+            // One period in the middle, zero outside
+            const float periodScale = std::pow(7.f, -scale);
+            for (size_t i = 0; i < SIZE; i++)
+                x[i] *= periodScale;
+
+            if (type == WaveType::SQUARE)
+            {
+                const auto curve = [](float x) { return -(std::abs(x) <= 0.5f ? (x > 0.f ? 1.f : -1.f) : 0.f); };
+                const float factor = (periodScale * (1 + std::abs(shift))) < 0.5f ? 1 / std::max(curve(left * periodScale), std::abs(curve(right * periodScale))) : 1;
+                for (size_t i = 0; i < SIZE; i++)
+                    y[i] = factor * curve(x[i]);
+                break;
+            }
+
+            const bool sine = type == WaveType::SINE;
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = sine ? std::sin(TWO_PI * x[i]) : std::cos(TWO_PI * x[i]);
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = std::abs(x[i]) <= 0.5f ? y[i] : 0.f;
+
+            if (sine)
+            {
+                const auto curve = [](float x) { return -(std::abs(x) <= 0.5f ? std::sin(TWO_PI * x) : 0.f); };
+                const float factor = (periodScale * (1 + std::abs(shift))) < 0.5f ? 1 / std::max(curve(left * periodScale), std::abs(curve(right * periodScale))) : 1;
+                for (size_t i = 0; i < SIZE; i++)
+                    y[i] = -factor * y[i];
+            }
+            else
+            {
+                // Cosine: shifted and stretched so both ends sit at -1, if the period fits into the table
+                const auto curve = [](float x) { return std::abs(x) <= 0.5f ? std::cos(TWO_PI * x) : 0.f; };
+                const bool fits = periodScale * (1 + std::abs(shift)) < 1;
+                const float offset = fits ? 2 / (1 - std::min(curve(left * periodScale), curve(right * periodScale))) : 1;
+                const float add = fits ? offset - 1 : 0;
+                for (size_t i = 0; i < SIZE; i++)
+                    y[i] = -offset * y[i] + add;
+            }
+            break;
+        }
 
-                float squareScale = pow(7, -scale);
-                float factor = (squareScale * (1 + abs(shift))) < 0.5f ? 1 / std::max(squareCurve(0, shift, squareScale), abs(squareCurve(1, shift, squareScale))) : 1;
-                return factor * squareCurve(i / SIZE_F, shift, squareScale);
-            });
-            
-    }
-    return {};
-}
+        case WaveType::PARABOLA:
+        {
+            const float exponent = 0.25f + 1.75f / (1.f - 1.f / 15.f) * (std::pow(15.f, scale) - 1.f / 15.f);
+            const auto curve = [exponent](float x) { return std::pow(2 * std::abs(x), exponent); };
+
+            const float normalize = 1 / std::max(curve(left), curve(right));
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = curve(x[i]);
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] *= normalize;
+            break;
+        }
 
-// Like in Desmos
-inline float Wavetable::gaussianCurve(float x, float shift, float scale)
-{
-    const float e = MathConstants<float>::euler;
-    scale = pow(e, -1.75f * scale + 2.75f);
-    x = x - 0.5f - 0.5f * shift;
-    
-    return pow(e, -pow(1 / sqrt(2) * scale * x, 2));
-}
+        case WaveType::BARRIER:
+        {
+            // Parabola with a spike in the middle
+            const float factor = 4 * scale / (1 + 3 * shift);
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = factor * x[i] * x[i];
+            y[SIZE / 2] = 99.f;
+            break;
+        }
+
+        case WaveType::CUSTOM:
+        {
+            if (formula != nullptr)
+                formula->evaluate(shift, scale, y);
+            else
+                std::fill(y, y + SIZE, 0.f);
+            break;
+        }
 
-inline float Wavetable::sineCurve(float x, float shift, float scale)
-{
-    x = x - 0.5f - 0.5f * shift;
-    x *= scale;
-    
-    return -(abs(x) <= 0.5f ? sin(TWO_PI * x) : 0);
-}
+        case WaveType::SAWTOOTH:
+        {
+            const float exponent = sliderScaling(scale, 0.001f, 1.f, 16.f, 0.f);
+            for (size_t i = 0; i < SIZE; i++)
+            {
+                // fmod(u, 1) - 0.5 without the division
+                const float u = i / SIZE_F - shiftOffset;
+                x[i] = u - std::trunc(u) - 0.5f;
+            }
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = std::pow(2 * std::abs(x[i]), exponent);
+            for (size_t i = 0; i < SIZE; i++)
+                y[i] = x[i] > 0 ? -y[i] : y[i];
+            break;
+        }
+
+        default:
+            std::fill(y, y + SIZE, 0.f);
+            break;
+    }
 
-inline float Wavetable::cosCurve(float x, float shift, float scale)
-{
-    x = x - 0.5f - 0.5f * shift;
-    x *= scale;
-    
-    return (abs(x) <= 0.5f ? cos(TWO_PI * x) : 0);
+    for (size_t i = 0; i < SIZE; i++)
+        out[i] = cfloat(y[i], 0.f);
 }
 
-inline float Wavetable::parabolaCurve(float x, float shift, float scale)
-{
-    scale = 0.25f + 1.75f / (1.f - 1.f / 15.f) * (pow(15.f, scale) - 1.f / 15.f);
-    x = x - 0.5f - 0.5f * shift;
-    
-    return pow(2 * abs(x), scale);
-}
 
-inline float Wavetable::sawtoothCurve(float x, float shift, float scale)
+const cfloat* WavetableCache::generate(const size_t type, const float shift, const float scale, const Formula* formula)
 {
-    scale = sliderScaling(scale, 0.001f, 1.f, 16.f, 0.f);
-    x = fmod(x - 0.5f * shift, 1) - 0.5f;
+    useCounter++;
+    // Only custom shapes depend on the formula
+    const uint64 formulaHash = type == WaveType::CUSTOM && formula != nullptr ? formula->getHash() : 0;
 
-    return -((x > 0) ? 1 : -1) * pow(2 * abs(x), scale);
-}
+    Entry* oldest = &entries[0];
+    for (auto& entry : entries)
+    {
+        if (entry.valid && entry.type == type && entry.shift == shift && entry.scale == scale
+            && entry.formulaHash == formulaHash)
+        {
+            entry.lastUse = useCounter;
+            return entry.values.data();
+        }
+        if (!entry.valid || (oldest->valid && entry.lastUse < oldest->lastUse))
+            oldest = &entry;
+    }
 
-inline float Wavetable::squareCurve(float x, float shift, float scale)
-{
-    x = x - 0.5f - 0.5f * shift;
-    x *= scale;
-    
-    return -(abs(x) <= 0.5f ? ((fmod(x, 1.0f) > 0.0f) ? 1.0f : -1.0f) : 0);
+    Wavetable::generate(type, shift, scale, oldest->values.data(), formula);
+    oldest->valid = true;
+    oldest->type = type;
+    oldest->shift = shift;
+    oldest->scale = scale;
+    oldest->formulaHash = formulaHash;
+    oldest->lastUse = useCounter;
+    return oldest->values.data();
 }
 
 
-
-
 // From my desmos at https://www.desmos.com/calculator/rzdmd1hksl?lang=de
 inline float Wavetable::sliderScaling(float sliderValue, float valueAtNeg1, float valueAt0, float valueAt1, float mixLinear)
 {
@@ -159,7 +208,23 @@ float Wavetable::midiNoteToFrequency(const int noteNumber)
     return A4_FREQUENCY * std::pow(2.f, (noteNumber - A4_NOTE_NUMBER) / SEMITONES_PER_OCTAVE);
 }
 
-float Wavetable::frequencyToIncrement(const float frequency, const float sampleRate)
+uint32 Wavetable::frequencyToPhaseIncrement(const float frequency, const float sampleRate)
 {
-    return frequency * (float)(SIZE / sampleRate);
+    // one full table per period = 2^32 phase units
+    const double increment = std::ldexp(static_cast<double>(frequency) / sampleRate, 32);
+    return static_cast<uint32>(std::min(increment, 4294967295.0));
+}
+
+int Wavetable::bandLimitLevel(const uint32 phaseIncrement, const bool squared)
+{
+    // harmonic h is below Nyquist if h * phaseIncrement <= 2^31
+    int level = 0;
+    while (level < BANDLIMIT_LEVELS - 1)
+    {
+        const uint64 harmonics = static_cast<uint64>((SIZE / 2) >> level) << (squared ? 1 : 0);
+        if (harmonics * phaseIncrement <= (uint64(1) << 31))
+            break;
+        level++;
+    }
+    return level;
 }
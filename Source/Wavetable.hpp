@@ -11,7 +11,9 @@
 #pragma once
 #include "JuceHeader.h"
 #include <complex>
+#include <array>
 #include "list.hpp"
+#include "Parameter.h"
 
 typedef std::complex<float> cfloat;
 
@@ -20,6 +22,7 @@ class Wavetable
 public:
     // Important Constants
     constexpr static size_t SIZE = 128;            // Number of Samples per Wavetable
+    constexpr static int SIZE_BITS = 7;            // SIZE = 2^SIZE_BITS
     constexpr static float A4_FREQUENCY = 440.f;
     constexpr static float A4_NOTE_NUMBER = 69.f;
     constexpr static float SEMITONES_PER_OCTAVE = 12.f;
@@ -28,17 +31,96 @@ public:
     constexpr static float SIZE_F = static_cast<float>(SIZE);
     constexpr static float TWO_PI = MathConstants<float>::twoPi;
 
-    static list<cfloat> generate(const size_t type, const float shift, const float scale);
+    // Playback tables are resynthesized from the spectrum with OVERSAMPLING times the points
+    constexpr static int OVERSAMPLING_BITS = 2;
+    constexpr static size_t OVERSAMPLING = 1 << OVERSAMPLING_BITS;
+    constexpr static size_t PLAYBACK_SIZE = SIZE * OVERSAMPLING;
+    constexpr static int PLAYBACK_SIZE_BITS = SIZE_BITS + OVERSAMPLING_BITS;
+
+    // Band limited versions of a playback table, one per octave: level L keeps the harmonics up to (SIZE / 2) >> L
+    constexpr static int BANDLIMIT_LEVELS = SIZE_BITS;
+
+    // 32 bit fixed-point phase: the top PLAYBACK_SIZE_BITS index the playback table, the low bits are the interpolation fraction.
+    // The wrap at the table end is the unsigned overflow.
+    constexpr static int PHASE_FRACTION_BITS = 32 - PLAYBACK_SIZE_BITS;
+    constexpr static uint32 PHASE_FRACTION_MASK = (1u << PHASE_FRACTION_BITS) - 1;
+    constexpr static float PHASE_FRACTION_SCALE = 1.f / static_cast<float>(1u << PHASE_FRACTION_BITS);
+    static_assert(SIZE == (1u << SIZE_BITS), "SIZE must be a power of two");
+
+    // Playback tables are padded with wrapped values so every interpolation kernel can read its neighbours without modulo
+    constexpr static int PAD_BEFORE = 2;
+    constexpr static int PAD_AFTER = 3;
+    constexpr static size_t PADDED_SIZE = PLAYBACK_SIZE + PAD_BEFORE + PAD_AFTER;
+
+    // table points to index 0 of a padded table, x is the fraction between table[index] and table[index + 1]
+    template <Interpolation Type>
+    static inline float interpolate(const float* table, const uint32 index, const float x)
+    {
+        const float* y = table + index;
+
+        if constexpr (Type == LINEAR)
+        {
+            return y[0] + (y[1] - y[0]) * x;
+        }
+        if constexpr (Type == HERMITE_4)
+        {
+            // Catmull-Rom spline through y[-1]..y[2]
+            const float c1 = 0.5f * (y[1] - y[-1]);
+            const float c2 = y[-1] - 2.5f * y[0] + 2.f * y[1] - 0.5f * y[2];
+            const float c3 = 0.5f * (y[2] - y[-1]) + 1.5f * (y[0] - y[1]);
+            return ((c3 * x + c2) * x + c1) * x + y[0];
+        }
+        if constexpr (Type == POLYNOMIAL_6)
+        {
+            // Lagrange polynomial through y[-2]..y[3]
+            const float a = x + 2, b = x + 1, d = x - 1, e = x - 2, f = x - 3;
+            const float ab = a * b, de = d * e, ef = e * f;
+            return - y[-2] * (b * x * d * ef) * (1.f / 120.f)
+                   + y[-1] * (a * x * d * ef) * (1.f / 24.f)
+                   - y[0]  * (ab * de * f)    * (1.f / 12.f)
+                   + y[1]  * (ab * x * ef)    * (1.f / 12.f)
+                   - y[2]  * (ab * x * d * f) * (1.f / 24.f)
+                   + y[3]  * (ab * x * de)    * (1.f / 120.f);
+        }
+    }
+
+    static list<cfloat> generate(const size_t type, const float shift, const float scale, const Formula* formula = nullptr);
+    // Writes SIZE values to out, no allocation (audio thread). formula is evaluated for WaveType::CUSTOM
+    static void generate(const size_t type, const float shift, const float scale, cfloat* out, const Formula* formula = nullptr);
     static float midiNoteToFrequency(const int noteNumber);
-    static float frequencyToIncrement(const float frequency, const float sampleRate);
+    static uint32 frequencyToPhaseIncrement(const float frequency, const float sampleRate);
+
+    // Lowest band limit level whose harmonics all stay below Nyquist at this phase increment.
+    // Squaring the wavefunction doubles the bandwidth of the played table.
+    static int bandLimitLevel(const uint32 phaseIncrement, const bool squared);
     
 private:
-    static inline float gaussianCurve(float x, float shift, float scale);
-    static inline float sineCurve(float x, float shift, float scale);
-    static inline float cosCurve(float x, float shift, float scale);
-    static inline float parabolaCurve(float x, float shift, float scale);
-    static inline float sawtoothCurve(float x, float shift, float scale);
-    static inline float squareCurve(float x, float shift, float scale);
-    
     static inline float sliderScaling(float sliderValue, float valueAtNeg1, float valueAt0, float valueAt1, float mixLinear);
 };
+
+/**
+ Remembers the last generated wavetables by (type, shift, scale, formula hash), the least recently used entry gets replaced.
+ Not thread-safe: every thread that generates owns its cache. Does not allocate.
+ */
+class WavetableCache
+{
+public:
+    static constexpr int NUM_ENTRIES = 4;
+
+    // SIZE values, stay valid for at least the next NUM_ENTRIES - 1 calls
+    const cfloat* generate(size_t type, float shift, float scale, const Formula* formula = nullptr);
+
+private:
+    struct Entry
+    {
+        bool valid = false;
+        size_t type = 0;
+        float shift = 0;
+        float scale = 0;
+        uint64 formulaHash = 0;
+        uint32 lastUse = 0;
+        std::array<cfloat, Wavetable::SIZE> values;
+    };
+    std::array<Entry, NUM_ENTRIES> entries;
+    uint32 useCounter = 0;
+};